@@ -1,11 +1,19 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#define CAAF_ENABLE_DEBUG_TOOLS
 #define CAAF_LZMA_LEVEL 5
+#define CAAF_LZMA_BLOCK_SIZE 1048576 // 1M, each block can be decompressed by a different thread
 #define CAAF_DECOMP_MEMORY_MAX 68157440 // 65M
+#define CAAF_CHUNK_MIN_SIZE 4096 // Smaller section ranges are not worth compressing on their own
 
 #define CAAF_HEADER_MAGIC "CAAF"
 #define CAAF_VERSION 0
@@ -41,8 +49,33 @@ namespace caaf
 
 enum section { unknown, STRT, MESH, GFXP, TEXD, SAMP };
 
+constexpr uint8_t sectionCnt = SAMP + 1;
+
+// Returns the bit of a section in a section mask.
+constexpr uint32_t sectionBit(section type)
+{
+	return 1u << type;
+}
+
+constexpr uint32_t allSections = (1u << sectionCnt) - 1;
+
 typedef uint16_t index;
 
+// Builds a magic number from its ASCII representation, as it would be read from a file.
+constexpr uint32_t makeMagic(const char (&str)[5])
+{
+	return (uint32_t)(uint8_t)str[0] | (uint32_t)(uint8_t)str[1] << 8 | (uint32_t)(uint8_t)str[2] << 16 |
+		   (uint32_t)(uint8_t)str[3] << 24;
+}
+
+constexpr uint32_t headerMagic = makeMagic(CAAF_HEADER_MAGIC);
+
+constexpr uint32_t strtMagic = makeMagic("STRT");
+constexpr uint32_t meshMagic = makeMagic("MESH");
+constexpr uint32_t gfxpMagic = makeMagic("GFXP");
+constexpr uint32_t texdMagic = makeMagic("TEXD");
+constexpr uint32_t sampMagic = makeMagic("SAMP");
+
 // Section header
 typedef struct secHeader {
 	char magic[4];
@@ -173,32 +206,244 @@ typedef struct sampler {
 	uint32_t props;
 } sampler;
 
+// Section directory entry
+typedef struct dirEntry {
+	const uint8_t *start; // nullptr if the section is not present
+	uint32_t count;
+} dirEntry;
+
+// Section directory, indexed by section type
+typedef struct directory {
+	dirEntry sections[sectionCnt];
+	uint16_t unknownCnt;
+} directory;
+
+// Section traits, map each section to its entry struct, magic and subsections.
+// Only defined for known sections so that misuse fails to compile.
+template <section S> struct section_traits;
+
+template <> struct section_traits<STRT> {
+	typedef char entry; // Null-terminated string
+	static constexpr uint32_t magic = strtMagic;
+	typedef tuple<> subsections;
+};
+
+template <> struct section_traits<MESH> {
+	typedef mesh entry;
+	static constexpr uint32_t magic = meshMagic;
+	typedef tuple<vtxBufData> subsections;
+	static constexpr array<uint32_t mesh::*, 1> subPtrs = {&mesh::vbdPtr};
+};
+
+template <> struct section_traits<GFXP> {
+	typedef gfxPip entry;
+	static constexpr uint32_t magic = gfxpMagic;
+	typedef tuple<vtxBufDesc, vtxAttr, colTargBlend, textSampBind> subsections;
+	static constexpr array<uint32_t gfxPip::*, 4> subPtrs = {&gfxPip::vbdPtr, &gfxPip::vaPtr, &gfxPip::ctbPtr,
+															  &gfxPip::tsbPtr};
+};
+
+template <> struct section_traits<TEXD> {
+	typedef texture entry;
+	static constexpr uint32_t magic = texdMagic;
+	typedef tuple<> subsections;
+};
+
+template <> struct section_traits<SAMP> {
+	typedef sampler entry;
+	static constexpr uint32_t magic = sampMagic;
+	typedef tuple<> subsections;
+};
+
+// Range over the entries of a section, entries are returned as references into the file.
+template <section S> class entryRange
+{
+	const uint8_t *ptrs; // The section's pointer array
+	uint32_t count;
+
+  public:
+	typedef typename section_traits<S>::entry entry;
+
+	class iterator
+	{
+		const uint8_t *ptrPos; // Position in the section's pointer array
+
+	  public:
+		iterator(const uint8_t *ptrPos) : ptrPos(ptrPos) {}
+
+		const entry &operator*() const
+		{
+			return *(const entry *)(ptrPos + *(const uint32_t *)ptrPos);
+		}
+
+		iterator &operator++()
+		{
+			ptrPos += sizeof(uint32_t);
+			return *this;
+		}
+
+		bool operator==(const iterator &other) const = default;
+	};
+
+	entryRange(const uint8_t *secStart, uint32_t count)
+		: ptrs(secStart != nullptr ? secStart + sizeof(secHeader) : nullptr), count(secStart != nullptr ? count : 0)
+	{
+	}
+
+	uint32_t size() const
+	{
+		return count;
+	}
+
+	const entry &operator[](uint32_t idx) const
+	{
+		return *iterator(ptrs + (idx << 2));
+	}
+
+	iterator begin() const
+	{
+		return iterator(ptrs);
+	}
+
+	iterator end() const
+	{
+		return iterator(ptrs + (count << 2));
+	}
+};
+
+// Range over the entries of a subsection, entries are returned as references into the file.
+template <typename T> class subRange
+{
+	const uint8_t *subStart;
+
+  public:
+	class iterator
+	{
+		const uint8_t *pos;
+		uint16_t stride;
+
+	  public:
+		iterator(const uint8_t *pos, uint16_t stride) : pos(pos), stride(stride) {}
+
+		const T &operator*() const
+		{
+			return *(const T *)pos;
+		}
+
+		iterator &operator++()
+		{
+			pos += stride;
+			return *this;
+		}
+
+		bool operator==(const iterator &other) const = default;
+	};
+
+	subRange(const uint8_t *subStart) : subStart(subStart) {}
+
+	uint16_t size() const
+	{
+		return ((const subHeader *)subStart)->count;
+	}
+
+	const T &operator[](uint16_t idx) const
+	{
+		return *(const T *)(subStart + sizeof(subHeader) + ((const subHeader *)subStart)->size * idx);
+	}
+
+	iterator begin() const
+	{
+		return iterator(subStart + sizeof(subHeader), ((const subHeader *)subStart)->size);
+	}
+
+	iterator end() const
+	{
+		const subHeader *header = (const subHeader *)subStart;
+		return iterator(subStart + sizeof(subHeader) + header->size * header->count, header->size);
+	}
+};
+
+// internal helper
+template <typename T, typename... Ts> constexpr size_t subsectionIndex(tuple<Ts...> *)
+{
+	size_t idx = 0;
+	bool found = ((is_same_v<T, Ts> ? true : (++idx, false)) || ...);
+	return found ? idx : sizeof...(Ts);
+}
+
+// Returns the subsection of type T of a section entry. Fails to compile if the entry has no such subsection.
+template <section S, typename T> subRange<T> getSubsection(const typename section_traits<S>::entry &entry)
+{
+	typedef typename section_traits<S>::subsections subsections;
+	constexpr size_t idx = subsectionIndex<T>((subsections *)nullptr);
+
+	static_assert(idx < tuple_size_v<subsections>, "Type is not a subsection of this section.");
+
+	return subRange<T>((const uint8_t *)&entry + entry.*section_traits<S>::subPtrs[idx]);
+}
+
 // Returns a pointer to the start of the section, meant to be used with other functions.
-uint8_t *getSectionStart(uint8_t *caaf, uint16_t idx);
+const uint8_t *getSectionStart(const uint8_t *caaf, uint16_t idx);
 
 // Identifies the type of section from the pointer.
-section identifySection(uint8_t *secStart);
+section identifySection(const uint8_t *secStart);
 
 // Gets the amount of entries inside the section.
-uint16_t getSecEntryCnt(uint8_t *secStart);
+uint32_t getSecEntryCnt(const uint8_t *secStart);
 
 // Returns a pointer to the start of a section's entry by index.
-uint8_t *getSecEntryPtr(uint8_t *secStart, uint16_t idx);
+const uint8_t *getSecEntryPtr(const uint8_t *secStart, uint32_t idx);
 
 // Gets the amount of entries inside the subsection.
-uint16_t getSubEntryCnt(uint8_t *subStart);
+uint16_t getSubEntryCnt(const uint8_t *subStart);
 
 // Returns a pointer to the start of a subsection's entry by index.
-uint8_t *getSubEntryPtr(uint8_t *subStart, uint16_t idx);
+const uint8_t *getSubEntryPtr(const uint8_t *subStart, uint16_t idx);
+
+/*
+ * Checks that the header, every section, entry and subsection, string and mesh data lies within the buffer.
+ * Only the section headers of sections missing from the mask are checked, their entries may not have been loaded.
+ * Accessors do not perform bounds checks, so untrusted data must pass this once before being read.
+ */
+bool validate(const uint8_t *caaf, size_t size, uint32_t sections = allSections);
+
+/*
+ * Fills a section directory by walking the section list once, sections missing from the mask are left out.
+ * Returns false if STRT is not the first section, if it is not in the mask or if a known section is duplicated.
+ */
+bool buildDirectory(const uint8_t *caaf, directory *dir, uint32_t sections = allSections);
+
+// Gets a view of a string in the string table section by index, the view points into the section.
+string_view getStringView(const uint8_t *strSec, uint16_t idx, uint16_t limit = UINT16_MAX);
 
 // Gets a string from the string table section by index.
-string getString(uint8_t *strSec, uint16_t idx, uint16_t limit = UINT16_MAX);
+string getString(const uint8_t *strSec, uint16_t idx, uint16_t limit = UINT16_MAX);
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+// Byte range of a CAAF
+typedef struct range {
+	uint64_t start;
+	uint64_t end;
+	section owner; // unknown if the bytes are needed by every section
+} range;
+
+/*
+ * Splits a validated CAAF into consecutive ranges owned by a single section, covering the whole file.
+ * The header and section headers are shared, as is anything referenced by more than one section.
+ * Texture data has no size, it is assumed to last until the next byte used by anything else.
+ * Ranges smaller than minSize are shared and ranges bigger than maxSize are split.
+ */
+vector<range> splitSections(const uint8_t *caaf, size_t size, uint32_t minSize = CAAF_CHUNK_MIN_SIZE,
+							uint32_t maxSize = CAAF_LZMA_BLOCK_SIZE);
+#endif
 
 } // namespace caaf
 
 namespace csaf
 {
 
+constexpr uint32_t headerMagic = caaf::makeMagic(CSAF_HEADER_MAGIC);
+
 // CSAF file header
 typedef struct header {
 	char magic[4];
@@ -218,8 +463,14 @@ typedef struct shaderEntry {
 	uint32_t offset;
 } shaderEntry;
 
+/*
+ * Checks that the header, shader list and every shader lies within the buffer.
+ * Accessors do not perform bounds checks, so untrusted data must pass this once before being read.
+ */
+bool validate(const uint8_t *csaf, size_t size);
+
 // Returns a pointer to the shader coda and its size
-pair<uint8_t *, uint32_t> getShaderCode(uint8_t *csaf, uint16_t formats, uint16_t targetFormat);
+pair<const uint8_t *, uint32_t> getShaderCode(const uint8_t *csaf, uint16_t formats, uint16_t targetFormat);
 
 } // namespace csaf
 } // namespace engine
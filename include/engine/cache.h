@@ -0,0 +1,81 @@
+#pragma once
+
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+namespace engine
+{
+namespace gpu
+{
+
+class backend;
+
+// Cache traits, map each cached GPU object to its create info and the backend calls that create and release it.
+// Only defined for cached objects so that misuse fails to compile.
+template <typename T> struct cache_traits;
+
+template <> struct cache_traits<SDL_GPUGraphicsPipeline> {
+	typedef SDL_GPUGraphicsPipelineCreateInfo info;
+	static constexpr bool createLocked = false; // Workers do not wait on each other's pipelines
+	static SDL_GPUGraphicsPipeline *create(backend *gpu, const info &createInfo);
+	static void release(backend *gpu, SDL_GPUGraphicsPipeline *pipeline);
+};
+
+template <> struct cache_traits<SDL_GPUSampler> {
+	typedef SDL_GPUSamplerCreateInfo info;
+	static constexpr bool createLocked = true; // Cheap to create and few, duplicates are never made
+	static SDL_GPUSampler *create(backend *gpu, const info &createInfo);
+	static void release(backend *gpu, SDL_GPUSampler *sampler);
+};
+
+/*
+ * Shares GPU objects with identical state, owned by a backend.
+ * Objects are looked up by a key holding every byte of state they were created from, so that equal keys always mean
+ * equal objects. Each acquire takes a reference, the object is released with its last one.
+ * Every method may be called from any thread.
+ */
+template <typename T> class keyedCache
+{
+	typedef cache_traits<T> traits;
+
+	typedef struct cached {
+		T *object;
+		uint32_t refCnt;
+	} cached;
+
+	backend *gpu;
+	unordered_map<string, cached> objects;
+	unordered_map<T *, string> keys;
+	mutex lock;
+
+  public:
+	keyedCache(backend *gpu) : gpu(gpu) {}
+
+	/*
+	 * Returns the object created for the key, creating it from info if there is none.
+	 * Returns nullptr if the object could not be created.
+	 */
+	T *acquire(string_view key, const typename traits::info &info);
+
+	/*
+	 * Drops a reference taken by acquire. nullptr is ignored.
+	 */
+	void release(T *object);
+
+	/*
+	 * Releases every object. Called by the backend before it is destroyed, objects must not be in use anymore.
+	 */
+	void clear();
+};
+
+typedef keyedCache<SDL_GPUGraphicsPipeline> pipelineCache;
+typedef keyedCache<SDL_GPUSampler> samplerCache;
+
+} // namespace gpu
+} // namespace engine
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "engine/caaf.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define PACK_HEADER_MAGIC "PACK"
+#define PACK_VERSION 0
+
+using namespace std;
+
+namespace engine
+{
+namespace codec
+{
+
+// Compression codecs, stored in the pack header
+enum id : uint8_t { none, xz, lz4 };
+
+constexpr uint8_t codecCnt = lz4 + 1;
+
+constexpr uint32_t headerMagic = caaf::makeMagic(PACK_HEADER_MAGIC);
+
+// Pack header, followed by the chunk table if there is one and the compressed data
+typedef struct header {
+	char magic[4];
+	uint8_t version;
+	uint8_t codec;
+	uint16_t chunkCnt; // 0 if the file is compressed as a whole
+	uint64_t size; // Uncompressed size
+} header;
+
+// Chunk table entry, every chunk is compressed on its own with the codec of the pack
+typedef struct chunk {
+	uint64_t offset; // In the uncompressed file
+	uint64_t packedOffset; // From the start of the pack
+	uint32_t size;
+	uint32_t packedSize;
+	uint8_t section; // The caaf::section that needs the chunk, unknown if every section does
+	uint8_t padding[7];
+} chunk;
+
+// Returns the name of a codec, nullptr if unknown.
+const char *getName(id codec);
+
+// Returns the codec with the given name, false if there is none.
+bool fromName(string_view name, id *codec);
+
+/*
+ * Identifies compressed data, either a pack or a bare xz stream as written before packs existed.
+ * payload and payloadSize are set to the data of the codec itself, or to the chunk table for chunked packs.
+ * Returns false if the data is neither or the pack is malformed.
+ */
+bool identify(const uint8_t *data, size_t size, id *codec, const uint8_t **payload, size_t *payloadSize);
+
+/*
+ * Gets the chunk table of a pack, count is set to 0 for packs and bare xz streams compressed as a whole.
+ * Returns false if the table is malformed: chunks must follow each other and cover the whole file.
+ */
+bool getChunks(const uint8_t *data, size_t size, const chunk **chunks, uint16_t *count);
+
+/*
+ * Decompresses the chunks of a pack needed by the sections in the mask into out, which holds the whole file.
+ * Chunks every section needs are decompressed whatever the mask, unless shared is false so that a file can be
+ * decompressed in several passes.
+ * Chunks are decompressed in parallel on the job workers, the bytes of the chunks that are skipped are left untouched.
+ * Returns false if the pack is not chunked or a chunk is malformed.
+ */
+bool decompressChunks(const uint8_t *data, size_t size, uint8_t *out, uint32_t sections = caaf::allSections,
+					  bool shared = true);
+
+/*
+ * Decompresses a pack or bare xz stream, the compressed size needs to be passed through size.
+ * Returns a buffer allocated with new[] or nullptr on error, size is set to its size.
+ */
+uint8_t *decompress(const uint8_t *data, size_t *size);
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+/*
+ * Compresses data into a pack using the given codec, appended to out.
+ * blockSize is only used by xz, see lzma::compress.
+ * Returns true on success, false otherwise.
+ */
+bool compress(const uint8_t *data, size_t size, id codec, vector<uint8_t> &out,
+			  uint64_t blockSize = CAAF_LZMA_BLOCK_SIZE);
+
+/*
+ * Compresses data into a chunked pack, one chunk per range, appended to out.
+ * Ranges must follow each other and cover the whole data, see caaf::splitSections.
+ * Returns true on success, false otherwise.
+ */
+bool compress(const uint8_t *data, size_t size, id codec, const vector<caaf::range> &ranges, vector<uint8_t> &out);
+
+/*
+ * Compresses data into a pack file, chunked if ranges are given.
+ * Returns true on success, false otherwise.
+ */
+bool compress(const uint8_t *data, size_t size, id codec, string fileout, uint64_t blockSize = CAAF_LZMA_BLOCK_SIZE,
+			  const vector<caaf::range> &ranges = {});
+#endif
+
+} // namespace codec
+} // namespace engine
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "engine/cache.h"
+#include "engine/heap.h"
+#include "engine/staging.h"
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace engine
+{
+namespace gpu
+{
+
+/*
+ * Returns whether a format stores blocks of pixels.
+ * Those cannot be rendered into, so their mip levels are not generated.
+ */
+bool isBlockCompressed(SDL_GPUTextureFormat format);
+
+/*
+ * Every GPU call made by the loader goes through a backend, so that loading does not depend on a device.
+ * Release methods accept nullptr and ignore it.
+ * Objects may be created, mapped and released from any thread, uploads only from the thread that began them.
+ * Every backend owns a staging ring, vertex and index heaps, a pipeline cache and a sampler cache. Implementations hand
+ * the ring the fence of each upload and release all of them when destroyed.
+ */
+class backend
+{
+  protected:
+	stagingRing staging;
+	bufferHeap vtxHeap;
+	bufferHeap idxHeap;
+	pipelineCache pipelines;
+	samplerCache samplers;
+
+  public:
+	backend()
+		: staging(this), vtxHeap(this, SDL_GPU_BUFFERUSAGE_VERTEX), idxHeap(this, SDL_GPU_BUFFERUSAGE_INDEX),
+		  pipelines(this), samplers(this)
+	{
+	}
+	virtual ~backend() = default;
+
+	stagingRing &getStaging()
+	{
+		return staging;
+	}
+
+	bufferHeap &getVertexHeap()
+	{
+		return vtxHeap;
+	}
+
+	bufferHeap &getIndexHeap()
+	{
+		return idxHeap;
+	}
+
+	pipelineCache &getPipelines()
+	{
+		return pipelines;
+	}
+
+	samplerCache &getSamplers()
+	{
+		return samplers;
+	}
+
+	/*
+	 * Opens a copy pass, uploads recorded until endUpload are submitted together.
+	 */
+	virtual bool beginUpload() = 0;
+	virtual bool endUpload() = 0;
+
+	/*
+	 * Fences are signalled once the GPU has finished an upload, nullptr counts as signalled.
+	 */
+	virtual bool queryFence(SDL_GPUFence *fence) = 0;
+	virtual bool waitForFence(SDL_GPUFence *fence) = 0;
+	virtual void releaseFence(SDL_GPUFence *fence) = 0;
+
+	virtual SDL_GPUShaderFormat getShaderFormats() = 0;
+	virtual SDL_GPUTextureFormat getColorTargetFormat() = 0;
+	virtual SDL_GPUTextureFormat getDepthStencilFormat() = 0; // Invalid if there is no depth stencil target
+
+	virtual SDL_GPUTransferBuffer *createTransferBuffer(uint32_t size) = 0;
+	virtual void *mapTransferBuffer(SDL_GPUTransferBuffer *transBuf, bool cycle) = 0;
+	virtual void unmapTransferBuffer(SDL_GPUTransferBuffer *transBuf) = 0;
+	virtual void releaseTransferBuffer(SDL_GPUTransferBuffer *transBuf) = 0;
+
+	virtual SDL_GPUBuffer *createBuffer(SDL_GPUBufferUsageFlags usage, uint32_t size) = 0;
+	virtual void uploadToBuffer(const SDL_GPUTransferBufferLocation &src, const SDL_GPUBufferRegion &dst,
+								bool cycle) = 0;
+	virtual void releaseBuffer(SDL_GPUBuffer *buffer) = 0;
+
+	virtual SDL_GPUTexture *createTexture(const SDL_GPUTextureCreateInfo &info) = 0;
+	virtual void uploadToTexture(const SDL_GPUTextureTransferInfo &src, const SDL_GPUTextureRegion &dst,
+								 bool cycle) = 0;
+	virtual void releaseTexture(SDL_GPUTexture *texture) = 0;
+	virtual bool supportsTextureFormat(SDL_GPUTextureFormat format, SDL_GPUTextureType type,
+									   SDL_GPUTextureUsageFlags usage) = 0;
+
+	/*
+	 * Generates every mip level of a texture from its first one, recorded during an upload.
+	 * Mipmaps are generated once every copy of the upload is done, all of them in the same command buffer.
+	 */
+	virtual void generateMipmaps(SDL_GPUTexture *texture) = 0;
+
+	virtual SDL_GPUSampler *createSampler(const SDL_GPUSamplerCreateInfo &info) = 0;
+	virtual void releaseSampler(SDL_GPUSampler *sampler) = 0;
+
+	virtual SDL_GPUShader *createShader(const SDL_GPUShaderCreateInfo &info) = 0;
+	virtual void releaseShader(SDL_GPUShader *shader) = 0;
+
+	virtual SDL_GPUGraphicsPipeline *createGraphicsPipeline(const SDL_GPUGraphicsPipelineCreateInfo &info) = 0;
+	virtual void releaseGraphicsPipeline(SDL_GPUGraphicsPipeline *pipeline) = 0;
+};
+
+/*
+ * Forwards every call to an SDL GPU device.
+ */
+class sdlBackend : public backend
+{
+	SDL_GPUDevice *device;
+	SDL_GPUTextureFormat colorFormat;
+	SDL_GPUTextureFormat depthStencilFormat;
+
+	SDL_GPUCommandBuffer *cmdbuf;
+	SDL_GPUCopyPass *pass;
+	vector<SDL_GPUTexture *> mipmapped; // Generated when the upload ends, outside of the copy pass
+
+  public:
+	sdlBackend(SDL_GPUDevice *device, SDL_GPUTextureFormat colorFormat,
+			   SDL_GPUTextureFormat depthStencilFormat = SDL_GPU_TEXTUREFORMAT_INVALID);
+	~sdlBackend();
+
+	SDL_GPUDevice *getDevice() const
+	{
+		return device;
+	}
+
+	bool beginUpload() override;
+	bool endUpload() override;
+
+	bool queryFence(SDL_GPUFence *fence) override;
+	bool waitForFence(SDL_GPUFence *fence) override;
+	void releaseFence(SDL_GPUFence *fence) override;
+
+	SDL_GPUShaderFormat getShaderFormats() override;
+
+	SDL_GPUTextureFormat getColorTargetFormat() override
+	{
+		return colorFormat;
+	}
+
+	SDL_GPUTextureFormat getDepthStencilFormat() override
+	{
+		return depthStencilFormat;
+	}
+
+	SDL_GPUTransferBuffer *createTransferBuffer(uint32_t size) override;
+	void *mapTransferBuffer(SDL_GPUTransferBuffer *transBuf, bool cycle) override;
+	void unmapTransferBuffer(SDL_GPUTransferBuffer *transBuf) override;
+	void releaseTransferBuffer(SDL_GPUTransferBuffer *transBuf) override;
+
+	SDL_GPUBuffer *createBuffer(SDL_GPUBufferUsageFlags usage, uint32_t size) override;
+	void uploadToBuffer(const SDL_GPUTransferBufferLocation &src, const SDL_GPUBufferRegion &dst,
+						bool cycle) override;
+	void releaseBuffer(SDL_GPUBuffer *buffer) override;
+
+	SDL_GPUTexture *createTexture(const SDL_GPUTextureCreateInfo &info) override;
+	void uploadToTexture(const SDL_GPUTextureTransferInfo &src, const SDL_GPUTextureRegion &dst,
+						 bool cycle) override;
+	void releaseTexture(SDL_GPUTexture *texture) override;
+	bool supportsTextureFormat(SDL_GPUTextureFormat format, SDL_GPUTextureType type,
+							   SDL_GPUTextureUsageFlags usage) override;
+	void generateMipmaps(SDL_GPUTexture *texture) override;
+
+	SDL_GPUSampler *createSampler(const SDL_GPUSamplerCreateInfo &info) override;
+	void releaseSampler(SDL_GPUSampler *sampler) override;
+
+	SDL_GPUShader *createShader(const SDL_GPUShaderCreateInfo &info) override;
+	void releaseShader(SDL_GPUShader *shader) override;
+
+	SDL_GPUGraphicsPipeline *createGraphicsPipeline(const SDL_GPUGraphicsPipelineCreateInfo &info) override;
+	void releaseGraphicsPipeline(SDL_GPUGraphicsPipeline *pipeline) override;
+};
+
+// Counters kept by the null backend
+typedef struct stats {
+	uint32_t uploadCnt; // Submitted upload batches
+	uint64_t uploadBytes; // Bytes copied into buffers and textures
+	uint64_t transferBytes; // Bytes allocated for transfer buffers
+
+	uint32_t transferBufCnt; // Created
+	uint32_t bufferCnt;
+	uint32_t textureCnt;
+	uint32_t samplerCnt;
+	uint32_t shaderCnt;
+	uint32_t pipelineCnt;
+
+	uint32_t liveTransferBufs; // Created but not released yet
+	uint32_t liveBuffers;
+	uint32_t liveTextures;
+	uint32_t liveSamplers;
+	uint32_t liveShaders;
+	uint32_t livePipelines;
+	uint64_t liveBufferBytes;
+	uint64_t liveTextureBytes; // First level only
+
+	uint32_t mipmapCnt; // Textures mipmaps were generated for
+} stats;
+
+/*
+ * Keeps everything in system memory and records what would have been sent to the GPU.
+ * Transfer buffers are real allocations so mapping and copying costs the same as with a device.
+ */
+class nullBackend : public backend
+{
+	SDL_GPUShaderFormat shaderFormats;
+	stats counters;
+	bool uploading;
+	mutex lock; // Loads create objects from worker threads
+
+  public:
+	nullBackend(SDL_GPUShaderFormat shaderFormats = SDL_GPU_SHADERFORMAT_SPIRV | SDL_GPU_SHADERFORMAT_DXIL |
+													 SDL_GPU_SHADERFORMAT_MSL);
+
+	~nullBackend();
+
+	stats getStats();
+	void resetStats();
+
+	bool beginUpload() override;
+	bool endUpload() override;
+
+	bool queryFence(SDL_GPUFence *fence) override;
+	bool waitForFence(SDL_GPUFence *fence) override;
+	void releaseFence(SDL_GPUFence *fence) override;
+
+	SDL_GPUShaderFormat getShaderFormats() override
+	{
+		return shaderFormats;
+	}
+
+	SDL_GPUTextureFormat getColorTargetFormat() override
+	{
+		return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM;
+	}
+
+	SDL_GPUTextureFormat getDepthStencilFormat() override
+	{
+		return SDL_GPU_TEXTUREFORMAT_INVALID;
+	}
+
+	SDL_GPUTransferBuffer *createTransferBuffer(uint32_t size) override;
+	void *mapTransferBuffer(SDL_GPUTransferBuffer *transBuf, bool cycle) override;
+	void unmapTransferBuffer(SDL_GPUTransferBuffer *transBuf) override;
+	void releaseTransferBuffer(SDL_GPUTransferBuffer *transBuf) override;
+
+	SDL_GPUBuffer *createBuffer(SDL_GPUBufferUsageFlags usage, uint32_t size) override;
+	void uploadToBuffer(const SDL_GPUTransferBufferLocation &src, const SDL_GPUBufferRegion &dst,
+						bool cycle) override;
+	void releaseBuffer(SDL_GPUBuffer *buffer) override;
+
+	SDL_GPUTexture *createTexture(const SDL_GPUTextureCreateInfo &info) override;
+	void uploadToTexture(const SDL_GPUTextureTransferInfo &src, const SDL_GPUTextureRegion &dst,
+						 bool cycle) override;
+	void releaseTexture(SDL_GPUTexture *texture) override;
+	bool supportsTextureFormat(SDL_GPUTextureFormat format, SDL_GPUTextureType type,
+							   SDL_GPUTextureUsageFlags usage) override;
+	void generateMipmaps(SDL_GPUTexture *texture) override;
+
+	SDL_GPUSampler *createSampler(const SDL_GPUSamplerCreateInfo &info) override;
+	void releaseSampler(SDL_GPUSampler *sampler) override;
+
+	SDL_GPUShader *createShader(const SDL_GPUShaderCreateInfo &info) override;
+	void releaseShader(SDL_GPUShader *shader) override;
+
+	SDL_GPUGraphicsPipeline *createGraphicsPipeline(const SDL_GPUGraphicsPipelineCreateInfo &info) override;
+	void releaseGraphicsPipeline(SDL_GPUGraphicsPipeline *pipeline) override;
+};
+
+} // namespace gpu
+} // namespace engine
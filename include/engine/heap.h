@@ -0,0 +1,73 @@
+#pragma once
+
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define HEAP_ALIGN 16 // Alignment of every range, enough for any index or vertex offset
+#define HEAP_BLOCK_SIZE (64 << 20)
+
+using namespace std;
+
+namespace engine
+{
+namespace gpu
+{
+
+class backend;
+
+// Part of a heap's GPU buffer, bound at its offset
+typedef struct bufferRange {
+	SDL_GPUBuffer *buffer; // nullptr if nothing was allocated
+	uint32_t offset;
+	uint32_t size;
+} bufferRange;
+
+/*
+ * Suballocates ranges of a few large GPU buffers of one usage, owned by a backend.
+ * The heap is made of blocks, each one a GPU buffer with a free list that merges neighbouring ranges.
+ * Blocks are created the first time they are needed and kept until the heap is released, except for ranges larger
+ * than a block which get a block of their own that is released with them.
+ * Every method may be called from any thread.
+ */
+class bufferHeap
+{
+	typedef struct block {
+		SDL_GPUBuffer *buffer;
+		uint32_t size;
+		uint32_t used;
+		map<uint32_t, uint32_t> freeRanges; // Offset to size
+	} block;
+
+	backend *gpu;
+	SDL_GPUBufferUsageFlags usage;
+	uint32_t blockSize;
+	vector<block> blocks;
+	mutex lock;
+
+	bool take(block &blk, uint32_t size, bufferRange &range);
+
+  public:
+	bufferHeap(backend *gpu, SDL_GPUBufferUsageFlags usage, uint32_t blockSize = HEAP_BLOCK_SIZE);
+
+	/*
+	 * Allocates size bytes, returning false if no GPU buffer could be created.
+	 */
+	bool allocate(uint32_t size, bufferRange &range);
+
+	/*
+	 * Returns a range to the free list of its block. Ranges without a buffer are ignored.
+	 * The range must not be read by the GPU anymore once it is allocated again.
+	 */
+	void free(const bufferRange &range);
+
+	/*
+	 * Releases every block. Called by the backend before it is destroyed, ranges must not be in use anymore.
+	 */
+	void release();
+};
+
+} // namespace gpu
+} // namespace engine
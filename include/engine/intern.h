@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+using namespace std;
+
+namespace engine
+{
+namespace intern
+{
+
+// Small integer identifying an interned string, 0 is always the empty string.
+typedef uint32_t atom;
+
+/*
+ * Returns the atom of a string, interning it if it was not seen before.
+ * Atoms are process-wide and stay valid until the program exits.
+ */
+atom get(string_view str);
+
+/*
+ * Returns the string of an atom.
+ * The view stays valid until the program exits.
+ */
+string_view name(atom id);
+
+// Returns the hash of an atom's string, computed once when it was interned.
+uint64_t hash(atom id);
+
+} // namespace intern
+} // namespace engine
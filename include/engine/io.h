@@ -1,5 +1,9 @@
+#pragma once
+
 #include "engine/caaf.h"
+#include "engine/gpu.h"
 #include "engine/model.h"
+#include <future>
 #include <generator>
 #include <string>
 
@@ -15,38 +19,115 @@ namespace io
 
 /*
  * Loads a model from the title storage and any required dependencies.
+ * A dependency that would make the chain circular is left out with a warning, the model is loaded without it.
  * Models are cached so that they are not read more than once.
+ * GPU objects are created and uploaded through the backend in a single upload.
+ * The mesh payloads of a model are staged in one region of the backend's staging ring, mapped once.
+ * Vertex and index data is uploaded into ranges of the backend's shared heaps, freed with the model.
+ * Waits for the load and finishes it, so it must be called from the thread that owns the backend's copy pass.
  * Returns false if a model was not found or could not be opened.
  */
-bool loadModel(string name, SDL_GPUDevice *device, SDL_GPUCopyPass *pass);
+bool loadModel(string name, gpu::backend *gpu);
+
+/*
+ * Starts loading a model and its dependencies on a worker thread, see loadModel.
+ * Reading, decompression, parsing and GPU object creation run on the worker, uploads are left for finishLoads.
+ * A dependency starts loading on another worker as soon as its name has been decompressed, the model is only
+ * waited for where its indices into the dependency are resolved. Dependencies that another load is already loading
+ * are not waited for, the model is only published once they are opened.
+ * The result turns true once the model is published and is shared by every request for the same model.
+ */
+shared_future<bool> loadModelAsync(string name, gpu::backend *gpu);
+
+/*
+ * Records the uploads of every load that finished on a worker in a single upload, then publishes their models.
+ * Models depending on one that another load is still opening are published along with a later call, and so are loads
+ * staged in the same transfer buffer as a load that is still filling it.
+ * Mipmaps of the textures that were uploaded are generated in the same command buffer, once they are copied.
+ * Must be called regularly, e.g. once per frame, from the thread that owns the backend's copy pass.
+ * Returns false if the uploads could not be submitted, loads are kept for the next call if it could not begin.
+ */
+bool finishLoads(gpu::backend *gpu);
 
 /*
  * Loads a shader from the title storage.
  * Shaders are cached so that they are not read more than once.
  * Returns false if a shader was not found or could not be opened.
  */
-bool loadShader(string name, SDL_GPUDevice *device, SDL_GPUCopyPass *pass);
+bool loadShader(string name, gpu::backend *gpu);
+
+/*
+ * Decompresses xz mesh payloads straight into the staging buffer instead of keeping them in memory, on by default.
+ * With debug tools, streamed meshes have no vtxData and idxData.
+ * May be called from any thread, loads that are already queued keep the setting they were queued with.
+ */
+void setStreaming(bool enabled);
+
+/*
+ * Sets the mask of sections read from models, sections left out are treated as missing. All of them by default.
+ * Only the chunks of these sections are decompressed from chunked packs. STRT is always read.
+ * Models that are already loaded keep the sections they were loaded with, and so do loads that are already queued.
+ */
+void setLoadedSections(uint32_t sections);
+
+/*
+ * Sets how many bytes of CPU and GPU memory cached models and shaders may take, 0 for no limit. No limits by default.
+ * Once over budget, the least recently used models and shaders are evicted when loads are finished, except for the
+ * models those loads published.
+ * A model is used when it is published or requested again. Models with a handle or a dependent are never evicted,
+ * shaders only while no load is running. Pipelines keep working once their shaders are evicted.
+ */
+void setCacheBudgets(uint64_t cpuBytes, uint64_t gpuBytes);
+
+/*
+ * Returns how many bytes of CPU and GPU memory cached models and shaders are accounted for.
+ * Mesh payloads count on the GPU, views kept by debug tools on the CPU, shaders by the size of their code.
+ */
+void getCacheUsage(uint64_t *cpuBytes, uint64_t *gpuBytes);
+
+/*
+ * Returns a handle to a loaded model, empty if it is not loaded. Counts as a use for the cache budgets.
+ * A model stays in memory as long as a handle or a dependent model refers to it, even once it left the cache.
+ */
+model::handle getModel(string name);
+
+/*
+ * Drops a model from the cache, along with the dependencies that were only kept loaded for it.
+ * Models are deleted once no handle or dependent model refers to them anymore.
+ * Returns false if the model was not loaded.
+ */
+bool unloadModel(string name);
 
 /*
- * Clears all loaded models from memory.
+ * Drops every loaded model from the cache, models are deleted once no handle or dependent refers to them anymore.
+ * Loads that are still running are not affected and keep the dependencies they resolved.
  */
 void clearModels();
 
 /*
- * Clears all loaded shaders from memory.
+ * Clears all loaded shaders from memory and releases them.
+ * Pipelines that were created from them keep working. While loads are running the shaders are only released once
+ * finishLoads has finished all of them.
+ * Must be called before the backend that created the shaders is destroyed.
  */
 void clearShaders();
 
 /*
  * Returns a shader format compatible with the current platform from the ones passed.
  */
-SDL_GPUShaderFormat resolvePlatformShaderFormat(SDL_GPUShaderFormat formats, SDL_GPUDevice *device);
+SDL_GPUShaderFormat resolvePlatformShaderFormat(SDL_GPUShaderFormat formats, gpu::backend *gpu);
 
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
 /*
- * Reads a model from a path.
+ * Reads a model from a path, waiting for the load like loadModel.
+ */
+bool readModel(string path, gpu::backend *gpu);
+
+/*
+ * Starts reading a model from a path on a worker thread, see loadModelAsync.
+ * The result is true once the model is published, or if a model with the same name was already loaded.
  */
-bool readModel(string path, SDL_GPUDevice *device, SDL_GPUCopyPass *pass);
+shared_future<bool> readModelAsync(string path, gpu::backend *gpu);
 
 /*
  * Writes an model to the desired path.
@@ -61,7 +142,7 @@ void createModel(string name);
 /*
  * Reads a shader from a path.
  */
-bool loadShader(string path, SDL_GPUDevice *device, SDL_GPUCopyPass *pass);
+bool loadShader(string path, gpu::backend *gpu);
 
 generator<model::model> getModels();
 
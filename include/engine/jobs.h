@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+namespace engine
+{
+namespace jobs
+{
+
+/*
+ * Sets the number of worker threads, 0 uses one per core.
+ * Only takes effect if the workers have not been started yet.
+ */
+void setThreads(uint32_t threads);
+
+/*
+ * Queues a job to run on a worker thread, the workers are started by the first job.
+ * Jobs start in the order they were submitted.
+ */
+void submit(function<void()> job);
+
+/*
+ * Calls func once for every index below count, spread across the workers.
+ * The calling thread takes part and only returns once every call has finished,
+ * so it is safe to call from a job even when every worker is busy.
+ */
+void parallelFor(size_t count, const function<void(size_t)> &func);
+
+/*
+ * A job that can be joined. It runs on a worker, or on the thread that joins it if no worker has started it yet,
+ * so a job may join another one without waiting behind the queue, even when every worker is busy.
+ */
+class task
+{
+	struct state;
+	shared_ptr<state> shared;
+
+	static void run(state &st);
+
+  public:
+	task() = default;
+
+	/*
+	 * Queues the job like submit.
+	 */
+	explicit task(function<void()> job);
+
+	/*
+	 * Returns once the job has run. Does nothing if the task has no job.
+	 */
+	void join();
+};
+
+/*
+ * Runs the jobs left in the queue and stops the workers. Jobs submitted afterwards start them again.
+ */
+void shutdown();
+
+} // namespace jobs
+} // namespace engine
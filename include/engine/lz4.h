@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define LZ4_MAX_RATIO 255 // Bytes a single compressed byte can expand to at most
+
+using namespace std;
+
+namespace engine
+{
+namespace lz4
+{
+
+/*
+ * Decompresses a single LZ4 block, the uncompressed size must be known in advance.
+ * Every read and write is bounds checked, so malformed input cannot overrun either buffer.
+ * Returns false if the data is malformed or does not decompress to exactly dstSize bytes.
+ */
+bool decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize);
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+/*
+ * Compresses data into a single LZ4 block appended to out.
+ * Uses a greedy single-probe match finder, favouring speed over ratio like the reference fast mode.
+ */
+void compress(const uint8_t *data, size_t size, vector<uint8_t> &out);
+#endif
+
+} // namespace lz4
+} // namespace engine
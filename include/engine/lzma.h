@@ -1,14 +1,73 @@
+#pragma once
+
 #include "engine/caaf.h"
 #include <cstddef>
 #include <cstdint>
 #include <lzma.h>
-#include <string>
+#include <vector>
 
 namespace engine
 {
 namespace lzma
 {
 
+/*
+ * Sets the number of threads used to compress and decompress, 0 uses one per core.
+ * Streams are only decompressed in parallel if they were written with more than one block.
+ */
+void setThreads(uint32_t threads);
+
+/*
+ * Decompresses an xz stream in order into as many output buffers as needed,
+ * so that each part of the data can be written straight to where it is used.
+ */
+class decoder
+{
+	lzma_stream strm;
+	uint64_t outSize;
+	bool valid;
+
+  public:
+	/*
+	 * The compressed data must outlive the decoder.
+	 * The uncompressed size is read from the stream index, nothing is decoded yet.
+	 */
+	decoder(const uint8_t *data, size_t size);
+	~decoder();
+
+	decoder(const decoder &) = delete;
+	decoder &operator=(const decoder &) = delete;
+
+	// Returns false if the stream is malformed or a previous read failed.
+	bool isValid() const
+	{
+		return valid;
+	}
+
+	// Returns the size of the whole decompressed data.
+	uint64_t getSize() const
+	{
+		return outSize;
+	}
+
+	// Returns how many bytes have been decompressed so far.
+	uint64_t getPosition() const
+	{
+		return strm.total_out;
+	}
+
+	/*
+	 * Decompresses exactly the next len bytes into out.
+	 * Returns false if the data is malformed or ends before len bytes.
+	 */
+	bool read(uint8_t *out, size_t len);
+
+	/*
+	 * Checks that the whole stream was decompressed and its integrity checks passed.
+	 */
+	bool finish();
+};
+
 /*
  * The compressed filesize needs to be passed through size.
  * Returns a pointer to decompressed data or nullptr if error.
@@ -18,10 +77,10 @@ uint8_t *decompress(const uint8_t *data, size_t *size);
 
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
 /*
- * Compresses a file from memory to a file.
+ * Compresses data into an xz stream appended to out, split into independent blocks of blockSize bytes.
  * Returns true on success, false otherwise.
  */
-bool compress(const uint8_t *data, size_t size, string fileout);
+bool compress(const uint8_t *data, size_t size, vector<uint8_t> &out, uint64_t blockSize = CAAF_LZMA_BLOCK_SIZE);
 #endif
 
 } // namespace lzma
@@ -1,6 +1,11 @@
+#pragma once
+
 #include "caaf.h"
+#include "gpu.h"
+#include "view.h"
 #include <SDL3/SDL_filesystem.h>
 #include <SDL3/SDL_gpu.h>
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -11,44 +16,160 @@ namespace engine
 namespace model
 {
 
-class mesh
+class model;
+
+/*
+ * Texture and sampler bound to a slot of a shader stage, either may belong to a model of the dependency chain.
+ */
+class binding
 {
-	SDL_GPUDevice *device;
+  public:
+	uint32_t slot;
+	SDL_GPUShaderStage stage;
+
+	const model *texModel; // Owners of the texture and sampler, kept alive through dependsOn
+	uint32_t texIdx; // Indices within the owners, into the whole chain until the chain is built
+	const model *sampModel;
+	uint32_t sampIdx;
 
+	/*
+	 * Returns the texture and sampler to bind, either is nullptr if it was not created.
+	 */
+	SDL_GPUTextureSamplerBinding get() const;
+};
+
+class mesh
+{
   public:
-	SDL_GPUBuffer *vtxBuf;
-	SDL_GPUBuffer *idxBuf;
+	gpu::bufferRange vtx; // Ranges of the backend's vertex and index heaps
+	gpu::bufferRange idx;
 
 	uint32_t vtxOffsCnt;
 	uint32_t *vtxOffsets;
 
+	uint32_t bindingCnt; // Read from the texture sampler bindings of the mesh's pipeline
+	binding *bindings;
+
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
-	uint32_t vtxSize;
-	uint32_t idxSize;
-	uint8_t *vtxData;
-	uint8_t *idxData;
+	const uint8_t *vtxData; // Points into the model's source view
+	const uint8_t *idxData;
 #endif
 
 	~mesh();
 };
 
+// A model of a dependency chain and the index its entries start at in each section of the chain
+typedef struct chainLink {
+	const model *modl;
+	uint32_t bases[caaf::sectionCnt];
+} chainLink;
+
+/*
+ * Shared reference to a model, the model is deleted along with its last handle.
+ * Handles may be copied and dropped from any thread, a single handle may not be used by two threads at once.
+ */
+class handle
+{
+	model *modl;
+
+  public:
+	handle() : modl(nullptr) {}
+
+	/*
+	 * Takes a new reference to a model, or to none if modl is nullptr.
+	 */
+	explicit handle(model *modl);
+	handle(const handle &other);
+	handle(handle &&other) noexcept;
+	~handle();
+
+	handle &operator=(handle other) noexcept;
+
+	model *get() const
+	{
+		return modl;
+	}
+
+	model *operator->() const
+	{
+		return modl;
+	}
+
+	model &operator*() const
+	{
+		return *modl;
+	}
+
+	explicit operator bool() const
+	{
+		return modl != nullptr;
+	}
+
+	bool operator==(const handle &other) const
+	{
+		return modl == other.modl;
+	}
+
+	/*
+	 * Returns how many handles refer to the model, 0 for an empty handle.
+	 */
+	uint32_t useCount() const;
+	void reset();
+};
+
 class model
 {
-	SDL_GPUDevice *device;
+	gpu::backend *gpu; // Backend the GPU objects were created with
+	atomic<uint32_t> refCnt; // Handles referring to the model
+
+	friend class handle;
 
   public:
 	string name;
-	model *dependsOn;
+	handle dependsOn; // Kept alive as long as this model is
 	bool isDependency;
 
+	// Entries of each section in the source, not counting the ones of the dependency
+	uint32_t entryCnts[caaf::sectionCnt];
+
+	// This model and its dependencies in chain order, nullptr until the chain is built
+	uint32_t chainLen;
+	chainLink *chain;
+
 	uint32_t meshCnt;
 	mesh *meshes;
 	SDL_GPUGraphicsPipeline **pipelines;
 
+	uint32_t textureCnt;
+	SDL_GPUTexture **textures; // nullptr for textures that could not be created
+	uint64_t textureBytes; // Data uploaded for every texture and the mip levels generated from it
+
+	uint32_t samplerCnt;
+	SDL_GPUSampler **samplers; // Shared through the backend's sampler cache, nullptr if one could not be created
+
 	uint32_t blendStateCnt;
 	SDL_GPUColorTargetBlendState *blendStates;
 
+	caaf::view *source;
+
+	model(gpu::backend *gpu);
 	~model();
+
+	/*
+	 * Builds the chain once dependsOn is linked, where the entries of a dependency are appended after the ones of the
+	 * model depending on it, and resolves the bindings of the meshes through it. Bindings out of range are dropped.
+	 * The dependency must have built its own chain.
+	 */
+	void buildChain();
+
+	/*
+	 * Finds the model of the chain owning an entry of a section and sets idx to the index of the entry within that
+	 * model. Takes a binary search over the bases of the chain. Returns nullptr if the index is out of range.
+	 */
+	const model *resolve(caaf::section type, uint32_t &idx) const;
+
+	model(const model &) = delete;
+	model &operator=(const model &) = delete;
 };
 
 } // namespace model
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define STAGING_ALIGN 16 // Alignment of every region, payloads laid out in a region keep it
+#define STAGING_SLOT_SIZE (32 << 20)
+#define STAGING_SLOT_COUNT 3
+#define STAGING_NO_SLOT UINT16_MAX
+
+using namespace std;
+
+namespace engine
+{
+namespace gpu
+{
+
+class backend;
+
+// Part of the staging ring given to a load, or a transfer buffer of its own if the ring had no room
+typedef struct stagingRegion {
+	SDL_GPUTransferBuffer *transBuf;
+	uint32_t offset; // In the transfer buffer, always aligned
+	uint32_t size;
+	uint16_t slot; // STAGING_NO_SLOT if the region has its own transfer buffer
+} stagingRegion;
+
+/*
+ * Persistent transfer buffers that loads suballocate staging memory from, owned by a backend.
+ * The ring is made of slots, each one a transfer buffer filled front to back. Once a slot is full the next one is
+ * reused, after waiting on the fences of the uploads that read it. Uploads that are recorded but not submitted yet
+ * cannot be waited on, so the slot is mapped with cycling instead and the device gives it fresh memory.
+ * Slots are created the first time they are needed, so steady streaming creates and releases no transfer buffers.
+ * Regions larger than a slot, or asked for while the next slot still has regions being filled, get their own.
+ * Loads filling regions of the same slot share one mapping of it, the slot is unmapped once the last of them is
+ * filled. Uploads are only recorded from slots that are not mapped.
+ * Every method may be called from any thread.
+ */
+class stagingRing
+{
+	typedef struct slot {
+		SDL_GPUTransferBuffer *transBuf; // nullptr until first used
+		uint32_t head; // Where the next region starts
+		uint32_t pending; // Regions handed out and not recorded yet
+		uint64_t serial; // Last upload that reads from the slot
+		uint8_t *mapped; // nullptr while no region is being filled
+		uint32_t mapCnt; // Regions being filled
+		bool recording; // Uploads reading the slot are being recorded, it cannot be mapped
+	} slot;
+
+	backend *gpu;
+	uint32_t slotSize;
+	vector<slot> slots;
+	uint16_t current;
+
+	deque<pair<uint64_t, SDL_GPUFence *>> fences; // Of uploads the GPU may still be reading, oldest first
+	uint64_t submitted; // Serial of the last upload submitted, the one being recorded is the next
+	uint64_t completed; // Every upload up to this serial has finished
+	mutex lock;
+
+	void poll(uint64_t waitFor);
+	slot *nextSlot();
+
+  public:
+	stagingRing(backend *gpu, uint32_t slotSize = STAGING_SLOT_SIZE, uint16_t slotCnt = STAGING_SLOT_COUNT);
+
+	/*
+	 * Hands out size bytes of staging memory and maps them, returning the start of the region.
+	 * Returns nullptr if no transfer buffer could be created or mapped.
+	 */
+	uint8_t *acquire(uint64_t size, stagingRegion &region);
+
+	/*
+	 * Called once a region is filled, its slot is unmapped with the last region being filled.
+	 */
+	void unmap(const stagingRegion &region);
+
+	/*
+	 * Called before recording the uploads of a filled region. Returns false while other regions of its slot are being
+	 * filled, no region is handed out from the slot anymore so that it gets unmapped.
+	 * Slots cannot be mapped until endRecording is called, once every upload is recorded.
+	 */
+	bool beginRecording(const stagingRegion &region);
+	void endRecording();
+
+	/*
+	 * Gives a region back once its uploads are recorded in the current upload, or without recording anything.
+	 * The memory of a retired region is reused once the GPU has finished the upload.
+	 */
+	void retire(const stagingRegion &region);
+	void discard(const stagingRegion &region);
+
+	/*
+	 * Called by the backend when an upload is submitted, with the fence signalled once it has finished.
+	 * The ring takes ownership of the fence, nullptr if the upload was not submitted or there is nothing to wait for.
+	 */
+	void submit(SDL_GPUFence *fence);
+
+	/*
+	 * Waits for every upload and releases the slots. Called by the backend before it is destroyed,
+	 * regions must not be in use anymore.
+	 */
+	void release();
+};
+
+} // namespace gpu
+} // namespace engine
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "caaf.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace engine
+{
+namespace caaf
+{
+
+/*
+ * Read-only view of an uncompressed CAAF.
+ * The bytes are either memory-mapped from a file, a decompressed buffer adopted by the view or reserved memory.
+ * Accessors return pointers and references into the viewed data, nothing is copied.
+ */
+class view
+{
+	// Where the viewed bytes live, so that they are freed the right way
+	enum storage : uint8_t { heap, file, anonymous };
+
+	const uint8_t *data;
+	size_t size;
+	storage kind;
+	bool validated;
+
+	directory dir;
+
+  public:
+	/*
+	 * Adopts a buffer allocated with new[], it will be freed along with the view.
+	 */
+	view(uint8_t *data, size_t size);
+	~view();
+
+	view(const view &) = delete;
+	view &operator=(const view &) = delete;
+
+	/*
+	 * Maps a file read-only into memory.
+	 * Returns nullptr if the file does not exist or could not be mapped.
+	 */
+	static view *map(const char *path);
+
+	/*
+	 * Reserves zeroed memory for size bytes, filled by the caller through buffer.
+	 * Pages are only backed by physical memory once written, so bytes that are never written cost nothing.
+	 * Returns nullptr if the memory could not be reserved.
+	 */
+	static view *reserve(size_t size, uint8_t **buffer);
+
+	// Returns the first byte of the viewed data.
+	const uint8_t *getData() const
+	{
+		return data;
+	}
+
+	// Returns the size in bytes of the viewed data.
+	size_t getSize() const
+	{
+		return size;
+	}
+
+	// Returns the file header.
+	const header &getHeader() const
+	{
+		return *(const header *)data;
+	}
+
+	/*
+	 * Validates the whole CAAF once and builds the section directory.
+	 * Sections missing from the mask are left out, as if the file did not have them.
+	 * Must succeed before any other accessor is used, as they do not perform bounds checks.
+	 * Returns false if the data is malformed.
+	 */
+	bool validate(uint32_t sections = allSections)
+	{
+		validated = caaf::validate(data, size, sections) && caaf::buildDirectory(data, &dir, sections);
+		return validated;
+	}
+
+	// Returns true if the data passed validation.
+	bool isValidated() const
+	{
+		return validated;
+	}
+
+	// Returns the section directory.
+	const directory &getDirectory() const
+	{
+		return dir;
+	}
+
+	// Returns the start and entry count of a section, start is nullptr if the section is not present.
+	const dirEntry &getSection(section type) const
+	{
+		return dir.sections[type];
+	}
+
+	// Returns the entries of a section, the range is empty if the section is not present.
+	template <section S> entryRange<S> entries() const
+	{
+		return entryRange<S>(dir.sections[S].start, dir.sections[S].count);
+	}
+};
+
+} // namespace caaf
+} // namespace engine
@@ -0,0 +1,411 @@
+#include "engine/caaf.h"
+#include "engine/codec.h"
+#include "engine/gpu.h"
+#include "engine/intern.h"
+#include "engine/io.h"
+#include "engine/jobs.h"
+#include "engine/lzma.h"
+#include "engine/view.h"
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_stdinc.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BENCH_DEFAULT_ITERATIONS 50
+
+using namespace std;
+using namespace engine;
+
+typedef struct stageResult {
+	string stage;
+	string file;
+	uint64_t bytes; // Bytes processed per iteration
+	uint64_t packedBytes; // Compressed size for codec stages, 0 otherwise
+	vector<double> times; // Seconds per iteration
+} stageResult;
+
+typedef struct input {
+	string path;
+	uint8_t *packed;
+	size_t packedSize;
+	caaf::view *data; // Uncompressed
+	bool isShader;
+} input;
+
+static volatile uint64_t sink; // Keeps results from being optimized away
+
+// Runs a stage for the given number of iterations, timing each one.
+stageResult runStage(const char *stage, const input &in, uint64_t bytes, uint32_t iterations,
+					 const function<void()> &func)
+{
+	stageResult res = {.stage = stage, .file = in.path, .bytes = bytes, .packedBytes = 0};
+	res.times.reserve(iterations);
+
+	func(); // Warm up
+
+	for (uint32_t i = 0; i < iterations; i++) {
+		auto start = chrono::steady_clock::now();
+		func();
+		auto end = chrono::steady_clock::now();
+
+		res.times.push_back(chrono::duration<double>(end - start).count());
+	}
+
+	return res;
+}
+
+// Walks every section, entry and subsection through the untyped caaf:: accessors.
+uint64_t walkSections(const uint8_t *data)
+{
+	uint64_t sum = 0;
+	uint16_t sectCnt = ((const caaf::header *)data)->sectCnt;
+
+	for (uint16_t i = 0; i < sectCnt; i++) {
+		const uint8_t *secStart = caaf::getSectionStart(data, i);
+		caaf::section type = caaf::identifySection(secStart);
+		uint32_t entryCnt = caaf::getSecEntryCnt(secStart);
+
+		for (uint32_t j = 0; j < entryCnt; j++) {
+			const uint8_t *entryPtr = caaf::getSecEntryPtr(secStart, j);
+			sum += *entryPtr;
+
+			uint32_t subPtrs[4];
+			uint8_t subCnt = 0;
+
+			if (type == caaf::MESH) {
+				const caaf::mesh &mesh = *(const caaf::mesh *)entryPtr;
+				subPtrs[subCnt++] = mesh.vbdPtr;
+			} else if (type == caaf::GFXP) {
+				const caaf::gfxPip &gfxpip = *(const caaf::gfxPip *)entryPtr;
+				subPtrs[subCnt++] = gfxpip.vbdPtr;
+				subPtrs[subCnt++] = gfxpip.vaPtr;
+				subPtrs[subCnt++] = gfxpip.ctbPtr;
+				subPtrs[subCnt++] = gfxpip.tsbPtr;
+			}
+
+			for (uint8_t k = 0; k < subCnt; k++) {
+				const uint8_t *subStart = entryPtr + subPtrs[k];
+				uint16_t cnt = caaf::getSubEntryCnt(subStart);
+
+				for (uint16_t l = 0; l < cnt; l++)
+					sum += *caaf::getSubEntryPtr(subStart, l);
+			}
+		}
+	}
+
+	return sum;
+}
+
+// Reads every string in the string table and interns it.
+uint64_t readStrings(const caaf::view *view)
+{
+	uint64_t sum = 0;
+	const caaf::dirEntry &strt = view->getSection(caaf::STRT);
+
+	for (uint32_t i = 0; i < strt.count; i++) {
+		string_view str = caaf::getStringView(strt.start, i);
+		sum += str.size() + intern::get(str);
+	}
+
+	return sum;
+}
+
+// Returns the value at the given percentile of sorted data.
+double percentile(const vector<double> &sorted, double p)
+{
+	size_t idx = (size_t)(p * sorted.size());
+	return sorted[min(idx, sorted.size() - 1)];
+}
+
+void writeJson(FILE *out, vector<stageResult> &results, uint32_t iterations)
+{
+	fprintf(out, "{\n  \"iterations\": %u,\n  \"results\": [", iterations);
+
+	for (size_t i = 0; i < results.size(); i++) {
+		stageResult &res = results[i];
+		sort(res.times.begin(), res.times.end());
+
+		double total = 0;
+		for (double t : res.times)
+			total += t;
+
+		double mean = total / res.times.size();
+		double mbps = total > 0 ? (double)res.bytes * res.times.size() / total / 1e6 : 0;
+
+		fprintf(out, "%s\n    {\"stage\": \"%s\", \"file\": \"%s\", \"bytes\": %llu, \"mbps\": %.3f, ",
+				i ? "," : "", res.stage.c_str(), res.file.c_str(), (unsigned long long)res.bytes, mbps);
+		fprintf(out, "\"mean_us\": %.3f, \"min_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, ", mean * 1e6,
+				res.times.front() * 1e6, percentile(res.times, 0.5) * 1e6, percentile(res.times, 0.9) * 1e6);
+		fprintf(out, "\"p99_us\": %.3f, \"max_us\": %.3f", percentile(res.times, 0.99) * 1e6,
+				res.times.back() * 1e6);
+
+		if (res.packedBytes)
+			fprintf(out, ", \"packed_bytes\": %llu, \"ratio\": %.3f", (unsigned long long)res.packedBytes,
+					(double)res.bytes / res.packedBytes);
+
+		fprintf(out, "}");
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+}
+
+bool readInput(const char *path, input *in)
+{
+	filesystem::path file(path);
+
+	in->path = path;
+	in->packed = nullptr;
+	in->packedSize = 0;
+	in->isShader = file.stem().extension() == ".csaf" || file.extension() == ".csaf";
+
+	if (file.extension() != ".pak" && file.extension() != ".xz") {
+		in->data = caaf::view::map(path);
+		return in->data != nullptr;
+	}
+
+	void *packed = SDL_LoadFile(path, &in->packedSize);
+	if (packed == nullptr) return false;
+
+	in->packed = new uint8_t[in->packedSize];
+	memcpy(in->packed, packed, in->packedSize);
+	SDL_free(packed);
+
+	size_t size = in->packedSize;
+	uint8_t *data = codec::decompress(in->packed, &size);
+
+	if (data == nullptr) {
+		delete[] in->packed;
+		return false;
+	}
+
+	in->data = new caaf::view(data, size);
+	return true;
+}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+
+// Compresses an input with every codec and times how fast each one decompresses it.
+void compareCodecs(input &in, uint32_t iterations, vector<stageResult> &results)
+{
+	const uint8_t *data = in.data->getData();
+	size_t size = in.data->getSize();
+
+	for (uint8_t i = 0; i < codec::codecCnt; i++) {
+		codec::id codec = (codec::id)i;
+		vector<uint8_t> packed;
+
+		auto start = chrono::steady_clock::now();
+
+		if (!codec::compress(data, size, codec, packed)) {
+			cerr << "Could not compress " << in.path << " with " << codec::getName(codec) << endl;
+			continue;
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		stageResult encode = {.stage = string("encode_") + codec::getName(codec),
+							  .file = in.path,
+							  .bytes = size,
+							  .packedBytes = packed.size(),
+							  .times = {chrono::duration<double>(end - start).count()}};
+
+		stageResult decode = runStage((string("decode_") + codec::getName(codec)).c_str(), in, size, iterations, [&]() {
+			size_t outSize = packed.size();
+			uint8_t *out = codec::decompress(packed.data(), &outSize);
+			sink = sink + outSize;
+			delete[] out;
+		});
+
+		decode.packedBytes = packed.size();
+
+		results.push_back(encode);
+		results.push_back(decode);
+	}
+}
+
+#endif
+
+// Runs every stage that applies to an input.
+void benchInput(input &in, uint32_t iterations, vector<stageResult> &results)
+{
+	const uint8_t *data = in.data->getData();
+	size_t size = in.data->getSize();
+
+	if (in.packed != nullptr) {
+		results.push_back(runStage("decompress", in, size, iterations, [&]() {
+			size_t outSize = in.packedSize;
+			uint8_t *out = codec::decompress(in.packed, &outSize);
+			sink = sink + outSize;
+			delete[] out;
+		}));
+	}
+
+	if (in.isShader) {
+		if (!csaf::validate(data, size)) {
+			cerr << "Malformed CSAF " << in.path << endl;
+			return;
+		}
+
+		uint16_t formats = ((const csaf::header *)data)->shaderFormats;
+
+		results.push_back(runStage("shader", in, size, iterations, [&]() {
+			for (uint16_t format = 1; format; format <<= 1) {
+				if (!(formats & format)) continue;
+
+				auto [code, codeSize] = csaf::getShaderCode(data, formats, format);
+				sink = sink + (uintptr_t)code + codeSize;
+			}
+		}));
+	} else {
+		results.push_back(
+			runStage("validate", in, size, iterations, [&]() { sink = sink + caaf::validate(data, size); }));
+
+		if (!in.data->validate()) {
+			cerr << "Malformed CAAF " << in.path << endl;
+			return;
+		}
+
+		results.push_back(runStage("directory", in, size, iterations, [&]() {
+			caaf::directory dir;
+			sink = sink + caaf::buildDirectory(data, &dir);
+		}));
+
+		results.push_back(runStage("walk", in, size, iterations, [&]() { sink = sink + walkSections(data); }));
+
+		const caaf::dirEntry &strt = in.data->getSection(caaf::STRT);
+		uint64_t strBytes = 0;
+
+		for (uint32_t i = 0; i < strt.count; i++)
+			strBytes += caaf::getStringView(strt.start, i).size() + 1;
+
+		results.push_back(
+			runStage("strings", in, strBytes, iterations, [&]() { sink = sink + readStrings(in.data); }));
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+		// The null backend stands in for the device, so uploads are copied but never submitted
+		gpu::nullBackend gpu;
+
+		results.push_back(runStage("load", in, size, iterations, [&]() {
+			sink = sink + io::readModel(in.path, &gpu);
+			io::clearModels();
+		}));
+
+		// Compressed models stream xz mesh payloads by default, this measures the copy through memory instead
+		if (in.packed != nullptr) {
+			io::setStreaming(false);
+
+			results.push_back(runStage("load_nostream", in, size, iterations, [&]() {
+				sink = sink + io::readModel(in.path, &gpu);
+				io::clearModels();
+			}));
+
+			io::setStreaming(true);
+		}
+
+		const codec::chunk *chunks;
+		uint16_t chunkCnt = 0;
+
+		// Chunked packs can skip every section but STRT, this is the cost of reading a model's names
+		if (in.packed != nullptr && codec::getChunks(in.packed, in.packedSize, &chunks, &chunkCnt) && chunkCnt) {
+			io::setLoadedSections(caaf::sectionBit(caaf::STRT));
+
+			results.push_back(runStage("load_strt", in, size, iterations, [&]() {
+				sink = sink + io::readModel(in.path, &gpu);
+				io::clearModels();
+			}));
+
+			io::setLoadedSections(caaf::allSections);
+		}
+
+		io::clearShaders(); // Created by this file's backend
+#endif
+	}
+}
+
+void printUsage(const char *name)
+{
+	cerr << "Usage: " << name << " [-n iterations] [-o output.json] [-t threads] [--compare] files..." << endl;
+	cerr << "Files may be .caaf or .csaf, either uncompressed, packed (.pak) or bare xz (.xz)." << endl;
+	cerr << "--compare compresses each file with every codec and reports ratio and decode speed." << endl;
+	cerr << "Threads are used for decompression and loading, 0 uses one per core." << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+	const char *outPath = nullptr;
+	uint32_t threads = 0;
+	vector<const char *> paths;
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+	bool compare = false;
+#endif
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			iterations = max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+		else if (!strcmp(argv[i], "--compare"))
+			compare = true;
+#endif
+		else if (argv[i][0] == '-') {
+			printUsage(argv[0]);
+			return 1;
+		} else
+			paths.push_back(argv[i]);
+	}
+
+	if (paths.empty()) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	lzma::setThreads(threads);
+	jobs::setThreads(threads);
+
+	vector<stageResult> results;
+
+	for (const char *path : paths) {
+		input in;
+
+		if (!readInput(path, &in)) {
+			cerr << "Could not read " << path << endl;
+			continue;
+		}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+		if (compare)
+			compareCodecs(in, iterations, results);
+		else
+#endif
+			benchInput(in, iterations, results);
+
+		delete[] in.packed;
+		delete in.data;
+	}
+
+	FILE *out = outPath != nullptr ? fopen(outPath, "w") : stdout;
+
+	if (out == nullptr) {
+		cerr << "Could not open " << outPath << endl;
+		return 1;
+	}
+
+	writeJson(out, results, iterations);
+	if (out != stdout) fclose(out);
+
+	return 0;
+}
@@ -1,71 +1,393 @@
 #include "engine/caaf.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 namespace engine
 {
 namespace caaf
 {
 
-uint8_t *getSectionStart(uint8_t *caaf, uint16_t idx)
+const uint8_t *getSectionStart(const uint8_t *caaf, uint16_t idx)
 {
-	uint32_t secOffset = *(uint32_t *)(caaf + CAAF_SECTION_LIST_POS + (idx << 2));
+	uint32_t secOffset = *(const uint32_t *)(caaf + CAAF_SECTION_LIST_POS + (idx << 2));
 	return caaf + secOffset;
 }
 
-section identifySection(uint8_t *secStart)
+section identifySection(const uint8_t *secStart)
 {
-	secHeader header = *(secHeader *)secStart;
-	string str(header.magic, sizeof(header.magic));
-
-	if (str == "STRT") return STRT;
-	if (str == "GFXP") return GFXP;
-	if (str == "TEXD") return TEXD;
-	if (str == "SAMP") return SAMP;
-
-	return unknown;
+	switch (*(const uint32_t *)secStart) {
+		case strtMagic:
+			return STRT;
+		case meshMagic:
+			return MESH;
+		case gfxpMagic:
+			return GFXP;
+		case texdMagic:
+			return TEXD;
+		case sampMagic:
+			return SAMP;
+		default:
+			return unknown;
+	}
 }
 
-uint16_t getSecEntryCnt(uint8_t *secStart)
+uint32_t getSecEntryCnt(const uint8_t *secStart)
 {
-	secHeader header = *(secHeader *)secStart;
+	secHeader header = *(const secHeader *)secStart;
 	return header.count;
 }
 
-uint8_t *getSecEntryPtr(uint8_t *secStart, uint16_t idx)
+const uint8_t *getSecEntryPtr(const uint8_t *secStart, uint32_t idx)
 {
-	uint8_t *ptrPos = secStart + sizeof(secHeader) + (idx << 2);
-	uint32_t offset = *(uint32_t *)ptrPos;
+	const uint8_t *ptrPos = secStart + sizeof(secHeader) + ((uint64_t)idx << 2);
+	uint32_t offset = *(const uint32_t *)ptrPos;
 	return ptrPos + offset;
 }
 
-uint16_t getSubEntryCnt(uint8_t *subStart)
+uint16_t getSubEntryCnt(const uint8_t *subStart)
 {
-	subHeader header = *(subHeader *)subStart;
+	subHeader header = *(const subHeader *)subStart;
 	return header.count;
 }
 
-uint8_t *getSubEntryPtr(uint8_t *subStart, uint16_t idx)
+const uint8_t *getSubEntryPtr(const uint8_t *subStart, uint16_t idx)
 {
-	subHeader header = *(subHeader *)subStart;
-	uint8_t *ptr = subStart + sizeof(subHeader) + header.size * idx;
+	subHeader header = *(const subHeader *)subStart;
+	const uint8_t *ptr = subStart + sizeof(subHeader) + header.size * idx;
 	return ptr;
 }
 
-string getString(uint8_t *strSec, uint16_t idx, uint16_t limit)
+// internal method
+// Returns true if the range [offset, offset + len) lies within a buffer of the given size.
+inline bool inBounds(size_t size, uint64_t offset, uint64_t len)
+{
+	return offset <= size && len <= size - offset;
+}
+
+// internal method
+template <typename T> bool validateSubsection(const uint8_t *caaf, size_t size, uint64_t subOffset)
 {
-	if (idx > limit) return "";
+	if (!inBounds(size, subOffset, sizeof(subHeader))) return false;
+
+	subHeader header = *(const subHeader *)(caaf + subOffset);
+
+	// Entries may be bigger than the known struct but never smaller
+	if (header.count && header.size < sizeof(T)) return false;
 
-	const char *str = (char *)getSecEntryPtr(strSec, idx);
-	return string(str);
+	return inBounds(size, subOffset + sizeof(subHeader), (uint64_t)header.count * header.size);
 }
 
+// internal method
+template <section S, size_t... I>
+bool validateSubsections(const uint8_t *caaf, size_t size, uint64_t entryOffset, index_sequence<I...>)
+{
+	typedef section_traits<S> traits;
+	const typename traits::entry &entry = *(const typename traits::entry *)(caaf + entryOffset);
+
+	return (validateSubsection<tuple_element_t<I, typename traits::subsections>>(
+				caaf, size, entryOffset + entry.*traits::subPtrs[I]) &&
+			...);
+}
+
+// internal method
+template <section S> bool validateEntry(const uint8_t *caaf, size_t size, uint64_t entryOffset)
+{
+	typedef section_traits<S> traits;
+
+	if constexpr (S == STRT) {
+		// Strings must be null-terminated within the buffer
+		return entryOffset < size && memchr(caaf + entryOffset, 0, size - entryOffset) != nullptr;
+	} else {
+		if (!inBounds(size, entryOffset, sizeof(typename traits::entry))) return false;
+
+		const typename traits::entry &entry = *(const typename traits::entry *)(caaf + entryOffset);
+
+		if constexpr (S == MESH)
+			if (!inBounds(size, entryOffset + entry.meshPtr, (uint64_t)entry.vtxSize + entry.idxSize)) return false;
+
+		if constexpr (S == TEXD)
+			if (!inBounds(size, entryOffset + entry.dataPtr, 0)) return false;
+
+		return validateSubsections<S>(caaf, size, entryOffset,
+									  make_index_sequence<tuple_size_v<typename traits::subsections>>());
+	}
+}
+
+// internal method
+template <section S> bool validateSection(const uint8_t *caaf, size_t size, uint64_t secOffset)
+{
+	uint32_t count = ((const secHeader *)(caaf + secOffset))->count;
+	uint64_t ptrsOffset = secOffset + sizeof(secHeader);
+
+	if (!inBounds(size, ptrsOffset, (uint64_t)count << 2)) return false;
+
+	// The first string is always present and empty
+	if (S == STRT && !count) return false;
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t ptrPos = ptrsOffset + ((uint64_t)i << 2);
+		uint64_t entryOffset = ptrPos + *(const uint32_t *)(caaf + ptrPos);
+
+		if (!validateEntry<S>(caaf, size, entryOffset)) return false;
+	}
+
+	return true;
+}
+
+bool validate(const uint8_t *caaf, size_t size, uint32_t sections)
+{
+	if (size < CAAF_SECTION_LIST_POS) return false;
+
+	const header &hdr = *(const header *)caaf;
+
+	if (*(const uint32_t *)hdr.magic != headerMagic) return false;
+	if (!inBounds(size, CAAF_SECTION_LIST_POS, (uint64_t)hdr.sectCnt << 2)) return false;
+
+	for (uint16_t i = 0; i < hdr.sectCnt; i++) {
+		uint64_t secOffset = *(const uint32_t *)(caaf + CAAF_SECTION_LIST_POS + (i << 2));
+
+		if (!inBounds(size, secOffset, sizeof(secHeader))) return false;
+
+		section type = identifySection(caaf + secOffset);
+		bool valid = true;
+
+		// Sections left out may not have been loaded
+		if (!(sections & sectionBit(type))) continue;
+
+		switch (type) {
+			case STRT:
+				valid = validateSection<STRT>(caaf, size, secOffset);
+				break;
+			case MESH:
+				valid = validateSection<MESH>(caaf, size, secOffset);
+				break;
+			case GFXP:
+				valid = validateSection<GFXP>(caaf, size, secOffset);
+				break;
+			case TEXD:
+				valid = validateSection<TEXD>(caaf, size, secOffset);
+				break;
+			case SAMP:
+				valid = validateSection<SAMP>(caaf, size, secOffset);
+				break;
+			default: // Unknown sections are never read
+				break;
+		}
+
+		if (!valid) return false;
+	}
+
+	return true;
+}
+
+bool buildDirectory(const uint8_t *caaf, directory *dir, uint32_t sections)
+{
+	*dir = {};
+
+	uint16_t sectCnt = ((const header *)caaf)->sectCnt;
+	uint32_t found = 0; // Also tracks sections left out of the directory
+
+	for (uint16_t i = 0; i < sectCnt; i++) {
+		const uint8_t *secStart = getSectionStart(caaf, i);
+		section type = identifySection(secStart);
+
+		if (type == unknown) {
+			++dir->unknownCnt;
+			continue;
+		}
+
+		if ((i == 0) != (type == STRT) || found & sectionBit(type)) return false;
+
+		found |= sectionBit(type);
+
+		if (sections & sectionBit(type))
+			dir->sections[type] = {.start = secStart, .count = ((const secHeader *)secStart)->count};
+	}
+
+	return dir->sections[STRT].start != nullptr;
+}
+
+string_view getStringView(const uint8_t *strSec, uint16_t idx, uint16_t limit)
+{
+	if (idx > limit) return string_view();
+
+	return string_view((const char *)getSecEntryPtr(strSec, idx));
+}
+
+string getString(const uint8_t *strSec, uint16_t idx, uint16_t limit)
+{
+	return string(getStringView(strSec, idx, limit));
+}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+
+// Owner of the bytes that no section uses
+static constexpr uint8_t unowned = UINT8_MAX;
+
+// internal method
+// Marks the bytes in [start, end) as used by owner, bytes used by more than one section become shared.
+void markOwner(vector<uint8_t> &owners, uint64_t start, uint64_t end, section owner)
+{
+	for (uint64_t i = start; i < end && i < owners.size(); i++)
+		owners[i] = owners[i] == unowned || owners[i] == owner ? owner : unknown;
+}
+
+// internal method
+void markSubsection(const uint8_t *caaf, vector<uint8_t> &owners, uint64_t subOffset, section owner)
+{
+	subHeader header = *(const subHeader *)(caaf + subOffset);
+	markOwner(owners, subOffset, subOffset + sizeof(subHeader) + (uint64_t)header.count * header.size, owner);
+}
+
+// internal method
+template <section S, size_t... I>
+void markSubsections(const uint8_t *caaf, vector<uint8_t> &owners, uint64_t entryOffset, index_sequence<I...>)
+{
+	typedef section_traits<S> traits;
+	const typename traits::entry &entry = *(const typename traits::entry *)(caaf + entryOffset);
+
+	(markSubsection(caaf, owners, entryOffset + entry.*traits::subPtrs[I], S), ...);
+}
+
+// internal method
+// Marks the pointer array, entries, subsections and mesh payloads of a section. Texture data starts are returned.
+template <section S>
+void markSection(const uint8_t *caaf, vector<uint8_t> &owners, uint64_t secOffset, vector<uint64_t> &texData)
+{
+	typedef section_traits<S> traits;
+
+	uint32_t count = ((const secHeader *)(caaf + secOffset))->count;
+	uint64_t ptrsOffset = secOffset + sizeof(secHeader);
+
+	markOwner(owners, ptrsOffset, ptrsOffset + ((uint64_t)count << 2), S);
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t ptrPos = ptrsOffset + ((uint64_t)i << 2);
+		uint64_t entryOffset = ptrPos + *(const uint32_t *)(caaf + ptrPos);
+
+		if constexpr (S == STRT) {
+			markOwner(owners, entryOffset, entryOffset + strlen((const char *)caaf + entryOffset) + 1, S);
+		} else {
+			const typename traits::entry &entry = *(const typename traits::entry *)(caaf + entryOffset);
+			markOwner(owners, entryOffset, entryOffset + sizeof(entry), S);
+
+			if constexpr (S == MESH) {
+				uint64_t meshOffset = entryOffset + entry.meshPtr;
+				markOwner(owners, meshOffset, meshOffset + entry.vtxSize + entry.idxSize, S);
+			}
+
+			if constexpr (S == TEXD) texData.push_back(entryOffset + entry.dataPtr);
+
+			markSubsections<S>(caaf, owners, entryOffset,
+							   make_index_sequence<tuple_size_v<typename traits::subsections>>());
+		}
+	}
+}
+
+vector<range> splitSections(const uint8_t *caaf, size_t size, uint32_t minSize, uint32_t maxSize)
+{
+	vector<uint8_t> owners(size, unowned);
+	vector<uint64_t> texData;
+
+	uint16_t sectCnt = ((const header *)caaf)->sectCnt;
+	markOwner(owners, 0, CAAF_SECTION_LIST_POS + ((uint64_t)sectCnt << 2), unknown);
+
+	for (uint16_t i = 0; i < sectCnt; i++) {
+		uint64_t secOffset = getSectionStart(caaf, i) - caaf;
+
+		// Section headers are needed to find out which sections exist
+		markOwner(owners, secOffset, secOffset + sizeof(secHeader), unknown);
+
+		switch (identifySection(caaf + secOffset)) {
+			case STRT:
+				markSection<STRT>(caaf, owners, secOffset, texData);
+				break;
+			case MESH:
+				markSection<MESH>(caaf, owners, secOffset, texData);
+				break;
+			case GFXP:
+				markSection<GFXP>(caaf, owners, secOffset, texData);
+				break;
+			case TEXD:
+				markSection<TEXD>(caaf, owners, secOffset, texData);
+				break;
+			case SAMP:
+				markSection<SAMP>(caaf, owners, secOffset, texData);
+				break;
+			default: // The size of unknown sections is not known, they go along with their header
+				break;
+		}
+	}
+
+	for (uint64_t start : texData)
+		for (uint64_t i = start; i < size && owners[i] == unowned; i++)
+			owners[i] = TEXD;
+
+	// Padding goes along with the bytes before it, the header is always owned
+	for (size_t i = 1; i < size; i++)
+		if (owners[i] == unowned) owners[i] = owners[i - 1];
+
+	vector<range> runs;
+
+	for (size_t i = 0; i < size;) {
+		size_t end = i + 1;
+		while (end < size && owners[end] == owners[i])
+			end++;
+
+		section owner = end - i < minSize ? unknown : (section)owners[i];
+
+		if (!runs.empty() && runs.back().owner == owner)
+			runs.back().end = end;
+		else
+			runs.push_back({.start = i, .end = end, .owner = owner});
+
+		i = end;
+	}
+
+	vector<range> res;
+
+	for (const range &run : runs)
+		for (uint64_t start = run.start; start < run.end; start += maxSize)
+			res.push_back({.start = start, .end = min<uint64_t>(start + maxSize, run.end), .owner = run.owner});
+
+	return res;
+}
+
+#endif
+
 } // namespace caaf
 
 namespace csaf
 {
 
-pair<uint8_t *, uint32_t> getShaderCode(uint8_t *csaf, uint16_t formats, uint16_t targetFormat)
+bool validate(const uint8_t *csaf, size_t size)
+{
+	if (size < CSAF_SHADER_LIST_POS) return false;
+
+	const header &hdr = *(const header *)csaf;
+
+	if (*(const uint32_t *)hdr.magic != headerMagic) return false;
+
+	int shaderCnt = popcount(hdr.shaderFormats);
+	if (!caaf::inBounds(size, CSAF_SHADER_LIST_POS, (uint64_t)shaderCnt * sizeof(shaderEntry))) return false;
+
+	for (int i = 0; i < shaderCnt; i++) {
+		shaderEntry entry = *(const shaderEntry *)(csaf + CSAF_SHADER_LIST_POS + i * sizeof(shaderEntry));
+		if (!caaf::inBounds(size, entry.offset, entry.size)) return false;
+	}
+
+	return true;
+}
+
+pair<const uint8_t *, uint32_t> getShaderCode(const uint8_t *csaf, uint16_t formats, uint16_t targetFormat)
 {
 	// Calculate shader position in file:
 	uint8_t shaderPos = 0;
@@ -78,8 +400,8 @@ pair<uint8_t *, uint32_t> getShaderCode(uint8_t *csaf, uint16_t formats, uint16_
 		targetFormat >>= 1;
 	}
 
-	uint8_t *entryPtr = csaf + 0x10 + ((uint16_t)shaderPos << 3);
-	shaderEntry entry = *(shaderEntry *)entryPtr;
+	const uint8_t *entryPtr = csaf + CSAF_SHADER_LIST_POS + ((uint16_t)shaderPos << 3);
+	shaderEntry entry = *(const shaderEntry *)entryPtr;
 
 	return make_pair(csaf + entry.offset, entry.size);
 }
@@ -0,0 +1,98 @@
+#include "engine/cache.h"
+#include "engine/gpu.h"
+#include <SDL3/SDL_gpu.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace engine
+{
+namespace gpu
+{
+
+SDL_GPUGraphicsPipeline *cache_traits<SDL_GPUGraphicsPipeline>::create(backend *gpu, const info &createInfo)
+{
+	return gpu->createGraphicsPipeline(createInfo);
+}
+
+void cache_traits<SDL_GPUGraphicsPipeline>::release(backend *gpu, SDL_GPUGraphicsPipeline *pipeline)
+{
+	gpu->releaseGraphicsPipeline(pipeline);
+}
+
+SDL_GPUSampler *cache_traits<SDL_GPUSampler>::create(backend *gpu, const info &createInfo)
+{
+	return gpu->createSampler(createInfo);
+}
+
+void cache_traits<SDL_GPUSampler>::release(backend *gpu, SDL_GPUSampler *sampler)
+{
+	gpu->releaseSampler(sampler);
+}
+
+template <typename T> T *keyedCache<T>::acquire(string_view key, const typename traits::info &info)
+{
+	unique_lock guard(lock);
+	auto it = objects.find(string(key));
+
+	if (it == objects.end()) {
+		if constexpr (traits::createLocked) {
+			T *res = traits::create(gpu, info);
+			if (res == nullptr) return nullptr;
+
+			it = objects.try_emplace(string(key), res, 0).first;
+			keys[res] = key;
+		} else {
+			guard.unlock();
+
+			T *res = traits::create(gpu, info);
+			if (res == nullptr) return nullptr;
+
+			guard.lock();
+			auto [created, inserted] = objects.try_emplace(string(key), res, 0);
+
+			// Created by another worker in between
+			if (!inserted) traits::release(gpu, res);
+			else keys[res] = key;
+
+			it = created;
+		}
+	}
+
+	it->second.refCnt++;
+	return it->second.object;
+}
+
+template <typename T> void keyedCache<T>::release(T *object)
+{
+	if (object == nullptr) return;
+
+	lock_guard guard(lock);
+	auto key = keys.find(object);
+
+	if (key == keys.end()) return;
+
+	auto it = objects.find(key->second);
+	if (--it->second.refCnt) return;
+
+	traits::release(gpu, object);
+	objects.erase(it);
+	keys.erase(key);
+}
+
+template <typename T> void keyedCache<T>::clear()
+{
+	lock_guard guard(lock);
+
+	for (auto &[key, entry] : objects)
+		traits::release(gpu, entry.object);
+
+	objects.clear();
+	keys.clear();
+}
+
+template class keyedCache<SDL_GPUGraphicsPipeline>;
+template class keyedCache<SDL_GPUSampler>;
+
+} // namespace gpu
+} // namespace engine
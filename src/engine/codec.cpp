@@ -0,0 +1,319 @@
+#include "engine/codec.h"
+#include "engine/jobs.h"
+#include "engine/lz4.h"
+#include "engine/lzma.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace engine
+{
+namespace codec
+{
+
+static const char *const codecNames[codecCnt] = {"none", "xz", "lz4"};
+
+static const uint8_t xzMagic[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+
+const char *getName(id codec)
+{
+	return codec < codecCnt ? codecNames[codec] : nullptr;
+}
+
+bool fromName(string_view name, id *codec)
+{
+	for (uint8_t i = 0; i < codecCnt; i++) {
+		if (name == codecNames[i]) {
+			*codec = (id)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// internal method
+// Returns the pack header or nullptr for bare xz streams.
+const header *getHeader(const uint8_t *data, size_t size)
+{
+	if (size < sizeof(header)) return nullptr;
+
+	uint32_t magic;
+	memcpy(&magic, data, sizeof(magic));
+
+	return magic == headerMagic ? (const header *)data : nullptr;
+}
+
+bool identify(const uint8_t *data, size_t size, id *codec, const uint8_t **payload, size_t *payloadSize)
+{
+	const header *head = getHeader(data, size);
+
+	if (head != nullptr) {
+		if (head->version != PACK_VERSION || head->codec >= codecCnt) return false;
+
+		*codec = (id)head->codec;
+		*payload = data + sizeof(header);
+		*payloadSize = size - sizeof(header);
+		return true;
+	}
+
+	if (size < sizeof(xzMagic) || memcmp(data, xzMagic, sizeof(xzMagic))) return false;
+
+	*codec = xz;
+	*payload = data;
+	*payloadSize = size;
+	return true;
+}
+
+bool getChunks(const uint8_t *data, size_t size, const chunk **chunks, uint16_t *count)
+{
+	const header *head = getHeader(data, size);
+
+	*chunks = nullptr;
+	*count = 0;
+
+	if (head == nullptr || !head->chunkCnt) return true;
+	if ((uint64_t)head->chunkCnt * sizeof(chunk) > size - sizeof(header)) return false;
+
+	const chunk *table = (const chunk *)(data + sizeof(header));
+	uint64_t end = 0;
+
+	for (uint16_t i = 0; i < head->chunkCnt; i++) {
+		const chunk &chk = table[i];
+
+		if (chk.offset != end || chk.packedOffset > size || chk.packedSize > size - chk.packedOffset) return false;
+		end += chk.size;
+	}
+
+	if (end != head->size) return false;
+
+	*chunks = table;
+	*count = head->chunkCnt;
+	return true;
+}
+
+// internal method
+// Decompresses a single chunk into out, which has room for exactly its size.
+bool decompressChunk(const uint8_t *data, id codec, const chunk &chk, uint8_t *out)
+{
+	const uint8_t *packed = data + chk.packedOffset;
+
+	switch (codec) {
+		case none:
+			if (chk.packedSize != chk.size) return false;
+
+			memcpy(out, packed, chk.size);
+			return true;
+		case xz: {
+			lzma::decoder dec(packed, chk.packedSize);
+			return dec.isValid() && dec.getSize() == chk.size && dec.read(out, chk.size) && dec.finish();
+	}
+	case lz4:
+		return lz4::decompress(packed, chk.packedSize, out, chk.size);
+	}
+
+	return false;
+}
+
+bool decompressChunks(const uint8_t *data, size_t size, uint8_t *out, uint32_t sections, bool shared)
+{
+	const chunk *chunks;
+	uint16_t count;
+
+	id codec;
+	const uint8_t *payload;
+	size_t payloadSize;
+
+	if (!identify(data, size, &codec, &payload, &payloadSize) || !getChunks(data, size, &chunks, &count) || !count)
+		return false;
+
+	vector<uint16_t> needed;
+
+	// Chunks of unknown sections count as shared data
+	for (uint16_t i = 0; i < count; i++) {
+		uint8_t owner = chunks[i].section;
+		bool known = owner != caaf::unknown && owner < caaf::sectionCnt;
+
+		if (known ? sections & caaf::sectionBit((caaf::section)owner) : shared) needed.push_back(i);
+	}
+
+	atomic<bool> ok = true;
+
+	jobs::parallelFor(needed.size(), [&](size_t i) {
+		const chunk &chk = chunks[needed[i]];
+		if (ok && !decompressChunk(data, codec, chk, out + chk.offset)) ok = false;
+	});
+
+	return ok;
+}
+
+uint8_t *decompress(const uint8_t *data, size_t *size)
+{
+	id codec;
+	const uint8_t *payload;
+	size_t payloadSize;
+
+	if (!identify(data, *size, &codec, &payload, &payloadSize)) return nullptr;
+
+	const header *head = getHeader(data, *size);
+
+	if (head != nullptr && head->chunkCnt) {
+		if (head->size > SIZE_MAX) return nullptr;
+
+		uint8_t *res = new (nothrow) uint8_t[head->size];
+
+		if (res == nullptr || !decompressChunks(data, *size, res)) {
+			delete[] res;
+			return nullptr;
+		}
+
+		*size = head->size;
+		return res;
+	}
+
+	if (codec == xz) {
+		size_t resSize = payloadSize;
+		uint8_t *res = lzma::decompress(payload, &resSize);
+
+		// The size in the pack header must agree with the stream
+		if (res != nullptr && head != nullptr && resSize != head->size) {
+			delete[] res;
+			return nullptr;
+		}
+
+		*size = resSize;
+		return res;
+	}
+
+	if (head->size > SIZE_MAX) return nullptr;
+
+	size_t resSize = (size_t)head->size;
+
+	// The header is not trusted, sizes the payload cannot decode to are rejected before allocating
+	if (codec == none ? resSize != payloadSize : resSize / LZ4_MAX_RATIO > payloadSize) return nullptr;
+
+	uint8_t *res = new (nothrow) uint8_t[resSize];
+	if (res == nullptr) return nullptr;
+
+	bool ok = false;
+
+	switch (codec) {
+		case none:
+			ok = payloadSize == resSize;
+			if (ok) memcpy(res, payload, resSize);
+			break;
+		case lz4:
+			ok = lz4::decompress(payload, payloadSize, res, resSize);
+			break;
+		default:
+			break;
+	}
+
+	if (!ok) {
+		delete[] res;
+		return nullptr;
+	}
+
+	*size = resSize;
+	return res;
+}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+
+// internal method
+// Appends the data compressed with the codec alone to out.
+bool compressPayload(const uint8_t *data, size_t size, id codec, vector<uint8_t> &out, uint64_t blockSize)
+{
+	switch (codec) {
+		case none:
+			out.insert(out.end(), data, data + size);
+			return true;
+		case xz:
+			return lzma::compress(data, size, out, blockSize);
+		case lz4:
+			lz4::compress(data, size, out);
+			return true;
+	}
+
+	return false;
+}
+
+// internal method
+void putHeader(id codec, uint16_t chunkCnt, uint64_t size, vector<uint8_t> &out)
+{
+	header head = {.version = PACK_VERSION, .codec = codec, .chunkCnt = chunkCnt, .size = size};
+	memcpy(head.magic, PACK_HEADER_MAGIC, sizeof(head.magic));
+
+	const uint8_t *headBytes = (const uint8_t *)&head;
+	out.insert(out.end(), headBytes, headBytes + sizeof(head));
+}
+
+bool compress(const uint8_t *data, size_t size, id codec, vector<uint8_t> &out, uint64_t blockSize)
+{
+	if (codec >= codecCnt) return false;
+
+	putHeader(codec, 0, size, out);
+	return compressPayload(data, size, codec, out, blockSize);
+}
+
+bool compress(const uint8_t *data, size_t size, id codec, const vector<caaf::range> &ranges, vector<uint8_t> &out)
+{
+	if (codec >= codecCnt || ranges.empty() || ranges.size() > UINT16_MAX) return false;
+
+	size_t headPos = out.size();
+	putHeader(codec, (uint16_t)ranges.size(), size, out);
+
+	size_t tablePos = out.size();
+	out.resize(tablePos + ranges.size() * sizeof(chunk));
+
+	uint64_t end = 0;
+
+	for (size_t i = 0; i < ranges.size(); i++) {
+		const caaf::range &range = ranges[i];
+
+		if (range.start != end || range.end < range.start || range.end > size || range.end - range.start > UINT32_MAX)
+			return false;
+
+		size_t packedPos = out.size();
+		if (!compressPayload(data + range.start, range.end - range.start, codec, out, CAAF_LZMA_BLOCK_SIZE))
+			return false;
+
+		if (out.size() - packedPos > UINT32_MAX) return false;
+
+		chunk chk = {.offset = range.start,
+					 .packedOffset = packedPos - headPos,
+					 .size = (uint32_t)(range.end - range.start),
+					 .packedSize = (uint32_t)(out.size() - packedPos),
+					 .section = (uint8_t)range.owner};
+
+		memcpy(out.data() + tablePos + i * sizeof(chunk), &chk, sizeof(chk));
+		end = range.end;
+	}
+
+	return end == size;
+}
+
+bool compress(const uint8_t *data, size_t size, id codec, string fileout, uint64_t blockSize,
+			  const vector<caaf::range> &ranges)
+{
+	vector<uint8_t> out;
+
+	bool res = ranges.empty() ? compress(data, size, codec, out, blockSize) : compress(data, size, codec, ranges, out);
+	if (!res) return false;
+
+	ofstream fstrm(fileout, ios::binary);
+	fstrm.write((const char *)out.data(), out.size());
+
+	return fstrm.good();
+}
+
+#endif
+
+} // namespace codec
+} // namespace engine
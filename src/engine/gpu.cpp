@@ -0,0 +1,460 @@
+#include "engine/gpu.h"
+#include <SDL3/SDL_error.h>
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+namespace engine
+{
+namespace gpu
+{
+
+bool isBlockCompressed(SDL_GPUTextureFormat format)
+{
+	// A block of 4x4 pixels takes as much room as a single pixel
+	uint32_t size = SDL_CalculateGPUTextureFormatSize(format, 1, 1, 1);
+	return size && size == SDL_CalculateGPUTextureFormatSize(format, 4, 4, 1);
+}
+
+sdlBackend::sdlBackend(SDL_GPUDevice *device, SDL_GPUTextureFormat colorFormat,
+					   SDL_GPUTextureFormat depthStencilFormat)
+	: device(device), colorFormat(colorFormat), depthStencilFormat(depthStencilFormat), cmdbuf(nullptr),
+	  pass(nullptr)
+{
+}
+
+sdlBackend::~sdlBackend()
+{
+	if (pass != nullptr) endUpload();
+	staging.release();
+	vtxHeap.release();
+	idxHeap.release();
+	pipelines.clear();
+	samplers.clear();
+}
+
+bool sdlBackend::beginUpload()
+{
+	if (pass != nullptr) return true;
+
+	cmdbuf = SDL_AcquireGPUCommandBuffer(device);
+
+	if (cmdbuf == nullptr) {
+		cerr << SDL_GetError() << endl;
+		return false;
+	}
+
+	pass = SDL_BeginGPUCopyPass(cmdbuf);
+	return true;
+}
+
+bool sdlBackend::endUpload()
+{
+	if (pass == nullptr) return false;
+
+	SDL_EndGPUCopyPass(pass);
+
+	// Generated from the levels the copy pass uploaded
+	for (SDL_GPUTexture *texture : mipmapped)
+		SDL_GenerateMipmapsForGPUTexture(cmdbuf, texture);
+
+	mipmapped.clear();
+	SDL_GPUFence *fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cmdbuf);
+
+	pass = nullptr;
+	cmdbuf = nullptr;
+
+	if (fence == nullptr) cerr << SDL_GetError() << endl;
+
+	staging.submit(fence);
+	return fence != nullptr;
+}
+
+bool sdlBackend::queryFence(SDL_GPUFence *fence)
+{
+	return fence == nullptr || SDL_QueryGPUFence(device, fence);
+}
+
+bool sdlBackend::waitForFence(SDL_GPUFence *fence)
+{
+	return fence == nullptr || SDL_WaitForGPUFences(device, true, &fence, 1);
+}
+
+void sdlBackend::releaseFence(SDL_GPUFence *fence)
+{
+	if (fence != nullptr) SDL_ReleaseGPUFence(device, fence);
+}
+
+SDL_GPUShaderFormat sdlBackend::getShaderFormats()
+{
+	return SDL_GetGPUShaderFormats(device);
+}
+
+SDL_GPUTransferBuffer *sdlBackend::createTransferBuffer(uint32_t size)
+{
+	SDL_GPUTransferBufferCreateInfo info = {.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD, .size = size};
+	return SDL_CreateGPUTransferBuffer(device, &info);
+}
+
+void *sdlBackend::mapTransferBuffer(SDL_GPUTransferBuffer *transBuf, bool cycle)
+{
+	return SDL_MapGPUTransferBuffer(device, transBuf, cycle);
+}
+
+void sdlBackend::unmapTransferBuffer(SDL_GPUTransferBuffer *transBuf)
+{
+	SDL_UnmapGPUTransferBuffer(device, transBuf);
+}
+
+void sdlBackend::releaseTransferBuffer(SDL_GPUTransferBuffer *transBuf)
+{
+	if (transBuf != nullptr) SDL_ReleaseGPUTransferBuffer(device, transBuf);
+}
+
+SDL_GPUBuffer *sdlBackend::createBuffer(SDL_GPUBufferUsageFlags usage, uint32_t size)
+{
+	SDL_GPUBufferCreateInfo info = {.usage = usage, .size = size};
+	return SDL_CreateGPUBuffer(device, &info);
+}
+
+void sdlBackend::uploadToBuffer(const SDL_GPUTransferBufferLocation &src, const SDL_GPUBufferRegion &dst, bool cycle)
+{
+	SDL_UploadToGPUBuffer(pass, &src, &dst, cycle);
+}
+
+void sdlBackend::releaseBuffer(SDL_GPUBuffer *buffer)
+{
+	if (buffer != nullptr) SDL_ReleaseGPUBuffer(device, buffer);
+}
+
+SDL_GPUTexture *sdlBackend::createTexture(const SDL_GPUTextureCreateInfo &info)
+{
+	return SDL_CreateGPUTexture(device, &info);
+}
+
+void sdlBackend::uploadToTexture(const SDL_GPUTextureTransferInfo &src, const SDL_GPUTextureRegion &dst, bool cycle)
+{
+	SDL_UploadToGPUTexture(pass, &src, &dst, cycle);
+}
+
+void sdlBackend::releaseTexture(SDL_GPUTexture *texture)
+{
+	if (texture != nullptr) SDL_ReleaseGPUTexture(device, texture);
+}
+
+bool sdlBackend::supportsTextureFormat(SDL_GPUTextureFormat format, SDL_GPUTextureType type,
+									   SDL_GPUTextureUsageFlags usage)
+{
+	return SDL_GPUTextureSupportsFormat(device, format, type, usage);
+}
+
+void sdlBackend::generateMipmaps(SDL_GPUTexture *texture)
+{
+	mipmapped.push_back(texture);
+}
+
+SDL_GPUSampler *sdlBackend::createSampler(const SDL_GPUSamplerCreateInfo &info)
+{
+	return SDL_CreateGPUSampler(device, &info);
+}
+
+void sdlBackend::releaseSampler(SDL_GPUSampler *sampler)
+{
+	if (sampler != nullptr) SDL_ReleaseGPUSampler(device, sampler);
+}
+
+SDL_GPUShader *sdlBackend::createShader(const SDL_GPUShaderCreateInfo &info)
+{
+	return SDL_CreateGPUShader(device, &info);
+}
+
+void sdlBackend::releaseShader(SDL_GPUShader *shader)
+{
+	if (shader != nullptr) SDL_ReleaseGPUShader(device, shader);
+}
+
+SDL_GPUGraphicsPipeline *sdlBackend::createGraphicsPipeline(const SDL_GPUGraphicsPipelineCreateInfo &info)
+{
+	return SDL_CreateGPUGraphicsPipeline(device, &info);
+}
+
+void sdlBackend::releaseGraphicsPipeline(SDL_GPUGraphicsPipeline *pipeline)
+{
+	if (pipeline != nullptr) SDL_ReleaseGPUGraphicsPipeline(device, pipeline);
+}
+
+// Every handle given out by the null backend points to one of these
+typedef struct nullObject {
+	uint32_t size;
+	uint8_t *data; // Only transfer buffers have storage
+	SDL_GPUTextureFormat format; // Only for textures
+	bool mapped; // Only for transfer buffers
+} nullObject;
+
+nullBackend::nullBackend(SDL_GPUShaderFormat shaderFormats) : shaderFormats(shaderFormats), counters(), uploading(false)
+{
+}
+
+nullBackend::~nullBackend()
+{
+	staging.release();
+	vtxHeap.release();
+	idxHeap.release();
+	pipelines.clear();
+	samplers.clear();
+}
+
+stats nullBackend::getStats()
+{
+	lock_guard guard(lock);
+	return counters;
+}
+
+void nullBackend::resetStats()
+{
+	lock_guard guard(lock);
+	counters = {};
+}
+
+bool nullBackend::beginUpload()
+{
+	lock_guard guard(lock);
+	uploading = true;
+	return true;
+}
+
+bool nullBackend::endUpload()
+{
+	{
+		lock_guard guard(lock);
+		if (!uploading) return false;
+
+		uploading = false;
+		counters.uploadCnt++;
+	}
+
+	// Uploads are not read from the transfer buffers, so there is nothing to wait for
+	staging.submit(nullptr);
+	return true;
+}
+
+bool nullBackend::queryFence(SDL_GPUFence *fence)
+{
+	return true;
+}
+
+bool nullBackend::waitForFence(SDL_GPUFence *fence)
+{
+	return true;
+}
+
+void nullBackend::releaseFence(SDL_GPUFence *fence) {}
+
+SDL_GPUTransferBuffer *nullBackend::createTransferBuffer(uint32_t size)
+{
+	lock_guard guard(lock);
+	counters.transferBufCnt++;
+	counters.liveTransferBufs++;
+	counters.transferBytes += size;
+
+	return (SDL_GPUTransferBuffer *)new nullObject{size, new uint8_t[size]};
+}
+
+void *nullBackend::mapTransferBuffer(SDL_GPUTransferBuffer *transBuf, bool cycle)
+{
+	nullObject *obj = (nullObject *)transBuf;
+	lock_guard guard(lock);
+
+	if (obj->mapped) {
+		cerr << "Null backend: transfer buffer mapped twice." << endl;
+		return nullptr;
+	}
+
+	obj->mapped = true;
+	return obj->data;
+}
+
+void nullBackend::unmapTransferBuffer(SDL_GPUTransferBuffer *transBuf)
+{
+	lock_guard guard(lock);
+	((nullObject *)transBuf)->mapped = false;
+}
+
+void nullBackend::releaseTransferBuffer(SDL_GPUTransferBuffer *transBuf)
+{
+	if (transBuf == nullptr) return;
+
+	lock_guard guard(lock);
+	nullObject *obj = (nullObject *)transBuf;
+	counters.liveTransferBufs--;
+
+	delete[] obj->data;
+	delete obj;
+}
+
+SDL_GPUBuffer *nullBackend::createBuffer(SDL_GPUBufferUsageFlags usage, uint32_t size)
+{
+	lock_guard guard(lock);
+	counters.bufferCnt++;
+	counters.liveBuffers++;
+	counters.liveBufferBytes += size;
+
+	return (SDL_GPUBuffer *)new nullObject{size, nullptr};
+}
+
+void nullBackend::uploadToBuffer(const SDL_GPUTransferBufferLocation &src, const SDL_GPUBufferRegion &dst, bool cycle)
+{
+	const nullObject &transBuf = *(const nullObject *)src.transfer_buffer;
+	const nullObject &buffer = *(const nullObject *)dst.buffer;
+
+	lock_guard guard(lock);
+
+	// Same checks the device would do, so bad uploads are caught without one
+	if (!uploading || transBuf.mapped || (uint64_t)src.offset + dst.size > transBuf.size ||
+		(uint64_t)dst.offset + dst.size > buffer.size) {
+		cerr << "Null backend: invalid upload of " << dst.size << " bytes." << endl;
+		return;
+	}
+
+	counters.uploadBytes += dst.size;
+}
+
+void nullBackend::releaseBuffer(SDL_GPUBuffer *buffer)
+{
+	if (buffer == nullptr) return;
+
+	lock_guard guard(lock);
+	nullObject *obj = (nullObject *)buffer;
+	counters.liveBuffers--;
+	counters.liveBufferBytes -= obj->size;
+
+	delete obj;
+}
+
+SDL_GPUTexture *nullBackend::createTexture(const SDL_GPUTextureCreateInfo &info)
+{
+	uint32_t size = SDL_CalculateGPUTextureFormatSize(info.format, info.width, info.height, info.layer_count_or_depth);
+	if (!size) return nullptr;
+
+	if (!supportsTextureFormat(info.format, info.type, info.usage)) {
+		cerr << "Null backend: texture format " << info.format << " does not support usage " << info.usage << "."
+			 << endl;
+		return nullptr;
+	}
+
+	lock_guard guard(lock);
+	counters.textureCnt++;
+	counters.liveTextures++;
+	counters.liveTextureBytes += size;
+
+	return (SDL_GPUTexture *)new nullObject{size, nullptr, info.format};
+}
+
+void nullBackend::uploadToTexture(const SDL_GPUTextureTransferInfo &src, const SDL_GPUTextureRegion &dst, bool cycle)
+{
+	const nullObject &transBuf = *(const nullObject *)src.transfer_buffer;
+	const nullObject &texture = *(const nullObject *)dst.texture;
+	uint32_t size = SDL_CalculateGPUTextureFormatSize(texture.format, dst.w, dst.h, dst.d);
+
+	lock_guard guard(lock);
+
+	if (!uploading || transBuf.mapped || !size || (uint64_t)src.offset + size > transBuf.size || size > texture.size) {
+		cerr << "Null backend: invalid texture upload of " << size << " bytes." << endl;
+		return;
+	}
+
+	counters.uploadBytes += size;
+}
+
+void nullBackend::releaseTexture(SDL_GPUTexture *texture)
+{
+	if (texture == nullptr) return;
+
+	lock_guard guard(lock);
+	nullObject *obj = (nullObject *)texture;
+	counters.liveTextures--;
+	counters.liveTextureBytes -= obj->size;
+
+	delete obj;
+}
+
+bool nullBackend::supportsTextureFormat(SDL_GPUTextureFormat format, SDL_GPUTextureType type,
+										SDL_GPUTextureUsageFlags usage)
+{
+	// Any format with a known size can be sampled, only uncompressed ones can be rendered into
+	if (!SDL_CalculateGPUTextureFormatSize(format, 1, 1, 1)) return false;
+	return !(usage & SDL_GPU_TEXTUREUSAGE_COLOR_TARGET) || !isBlockCompressed(format);
+}
+
+void nullBackend::generateMipmaps(SDL_GPUTexture *texture)
+{
+	lock_guard guard(lock);
+
+	if (!uploading) {
+		cerr << "Null backend: mipmaps generated outside of an upload." << endl;
+		return;
+	}
+
+	counters.mipmapCnt++;
+}
+
+SDL_GPUSampler *nullBackend::createSampler(const SDL_GPUSamplerCreateInfo &info)
+{
+	lock_guard guard(lock);
+	counters.samplerCnt++;
+	counters.liveSamplers++;
+
+	return (SDL_GPUSampler *)new nullObject{0, nullptr};
+}
+
+void nullBackend::releaseSampler(SDL_GPUSampler *sampler)
+{
+	if (sampler == nullptr) return;
+
+	lock_guard guard(lock);
+	counters.liveSamplers--;
+	delete (nullObject *)sampler;
+}
+
+SDL_GPUShader *nullBackend::createShader(const SDL_GPUShaderCreateInfo &info)
+{
+	lock_guard guard(lock);
+	counters.shaderCnt++;
+	counters.liveShaders++;
+
+	return (SDL_GPUShader *)new nullObject{(uint32_t)info.code_size, nullptr};
+}
+
+void nullBackend::releaseShader(SDL_GPUShader *shader)
+{
+	if (shader == nullptr) return;
+
+	lock_guard guard(lock);
+	counters.liveShaders--;
+	delete (nullObject *)shader;
+}
+
+SDL_GPUGraphicsPipeline *nullBackend::createGraphicsPipeline(const SDL_GPUGraphicsPipelineCreateInfo &info)
+{
+	if (info.vertex_shader == nullptr || info.fragment_shader == nullptr) return nullptr;
+
+	lock_guard guard(lock);
+	counters.pipelineCnt++;
+	counters.livePipelines++;
+
+	return (SDL_GPUGraphicsPipeline *)new nullObject{0, nullptr};
+}
+
+void nullBackend::releaseGraphicsPipeline(SDL_GPUGraphicsPipeline *pipeline)
+{
+	if (pipeline == nullptr) return;
+
+	lock_guard guard(lock);
+	counters.livePipelines--;
+	delete (nullObject *)pipeline;
+}
+
+} // namespace gpu
+} // namespace engine
@@ -0,0 +1,113 @@
+#include "engine/heap.h"
+#include "engine/gpu.h"
+#include <SDL3/SDL_gpu.h>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+
+namespace engine
+{
+namespace gpu
+{
+
+bufferHeap::bufferHeap(backend *gpu, SDL_GPUBufferUsageFlags usage, uint32_t blockSize)
+	: gpu(gpu), usage(usage), blockSize(blockSize & ~(uint32_t)(HEAP_ALIGN - 1))
+{
+}
+
+// internal method
+// Takes the first free range of the block that fits. Must be called with the lock held.
+bool bufferHeap::take(block &blk, uint32_t size, bufferRange &range)
+{
+	for (auto it = blk.freeRanges.begin(); it != blk.freeRanges.end(); it++) {
+		auto [offset, freeSize] = *it;
+		if (freeSize < size) continue;
+
+		blk.freeRanges.erase(it);
+		if (freeSize > size) blk.freeRanges[offset + size] = freeSize - size;
+
+		blk.used += size;
+		range.buffer = blk.buffer;
+		range.offset = offset;
+
+		return true;
+	}
+
+	return false;
+}
+
+bool bufferHeap::allocate(uint32_t size, bufferRange &range)
+{
+	range = {.buffer = nullptr, .offset = 0, .size = size};
+
+	if (!size || size > UINT32_MAX - HEAP_ALIGN + 1) return false;
+
+	uint32_t aligned = (size + HEAP_ALIGN - 1) & ~(uint32_t)(HEAP_ALIGN - 1);
+	lock_guard guard(lock);
+
+	if (aligned <= blockSize) {
+		for (block &blk : blocks)
+			if (blk.size == blockSize && take(blk, aligned, range)) return true;
+	}
+
+	uint32_t newSize = aligned <= blockSize ? blockSize : aligned;
+	SDL_GPUBuffer *buffer = gpu->createBuffer(usage, newSize);
+
+	if (buffer == nullptr) return false;
+
+	block &blk = blocks.emplace_back(buffer, newSize, 0, map<uint32_t, uint32_t>{{0, newSize}});
+	return take(blk, aligned, range);
+}
+
+void bufferHeap::free(const bufferRange &range)
+{
+	if (range.buffer == nullptr) return;
+
+	uint32_t aligned = (range.size + HEAP_ALIGN - 1) & ~(uint32_t)(HEAP_ALIGN - 1);
+	lock_guard guard(lock);
+
+	for (auto blk = blocks.begin(); blk != blocks.end(); blk++) {
+		if (blk->buffer != range.buffer) continue;
+
+		blk->used -= aligned;
+
+		// Blocks of a single oversized range go away with it
+		if (blk->size != blockSize && !blk->used) {
+			gpu->releaseBuffer(blk->buffer);
+			blocks.erase(blk);
+			return;
+		}
+
+		auto [it, inserted] = blk->freeRanges.emplace(range.offset, aligned);
+		auto next = std::next(it);
+
+		if (next != blk->freeRanges.end() && it->first + it->second == next->first) {
+			it->second += next->second;
+			blk->freeRanges.erase(next);
+		}
+
+		if (it != blk->freeRanges.begin()) {
+			auto prev = std::prev(it);
+
+			if (prev->first + prev->second == it->first) {
+				prev->second += it->second;
+				blk->freeRanges.erase(it);
+			}
+		}
+
+		return;
+	}
+}
+
+void bufferHeap::release()
+{
+	lock_guard guard(lock);
+
+	for (block &blk : blocks)
+		gpu->releaseBuffer(blk.buffer);
+
+	blocks.clear();
+}
+
+} // namespace gpu
+} // namespace engine
@@ -0,0 +1,143 @@
+#include "engine/intern.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+#define INTERN_BLOCK_SIZE 16384
+#define INTERN_MIN_BUCKETS 256
+
+namespace engine
+{
+namespace intern
+{
+
+typedef struct entry {
+	uint64_t hash;
+	const char *str;
+	uint32_t len;
+} entry;
+
+static vector<entry> entries = {{.hash = 0, .str = "", .len = 0}};
+static vector<atom> buckets; // Open addressing, 0 marks an empty bucket
+static vector<unique_ptr<char[]>> blocks; // String storage, never moved once written
+static size_t blockUsed = INTERN_BLOCK_SIZE;
+static shared_mutex lock;
+
+// internal method
+// FNV-1a
+uint64_t hashString(string_view str)
+{
+	uint64_t res = 0xcbf29ce484222325;
+
+	for (char c : str) {
+		res ^= (uint8_t)c;
+		res *= 0x100000001b3;
+	}
+
+	return res;
+}
+
+// internal method
+// Returns the bucket holding the string or the empty bucket where it should be inserted.
+atom *findBucket(string_view str, uint64_t strHash)
+{
+	size_t mask = buckets.size() - 1;
+
+	for (size_t i = strHash & mask;; i = (i + 1) & mask) {
+		atom id = buckets[i];
+		if (id == 0) return &buckets[i];
+
+		const entry &e = entries[id];
+		if (e.hash == strHash && string_view(e.str, e.len) == str) return &buckets[i];
+	}
+}
+
+// internal method
+void grow()
+{
+	vector<atom> old = move(buckets);
+	buckets.assign(old.empty() ? INTERN_MIN_BUCKETS : old.size() << 1, 0);
+
+	size_t mask = buckets.size() - 1;
+
+	for (atom id : old) {
+		if (id == 0) continue;
+
+		size_t i = entries[id].hash & mask;
+		while (buckets[i] != 0)
+			i = (i + 1) & mask;
+
+		buckets[i] = id;
+	}
+}
+
+// internal method
+const char *store(string_view str)
+{
+	if (str.size() > INTERN_BLOCK_SIZE) {
+		blocks.emplace_back(new char[str.size()]);
+		memcpy(blocks.back().get(), str.data(), str.size());
+		return blocks.back().get();
+	}
+
+	if (blockUsed + str.size() > INTERN_BLOCK_SIZE) {
+		blocks.emplace_back(new char[INTERN_BLOCK_SIZE]);
+		blockUsed = 0;
+	}
+
+	char *res = blocks.back().get() + blockUsed;
+	memcpy(res, str.data(), str.size());
+	blockUsed += str.size();
+
+	return res;
+}
+
+atom get(string_view str)
+{
+	if (str.empty()) return 0;
+
+	uint64_t strHash = hashString(str);
+
+	{
+		shared_lock readLock(lock);
+
+		if (!buckets.empty()) {
+			atom id = *findBucket(str, strHash);
+			if (id != 0) return id;
+		}
+	}
+
+	unique_lock writeLock(lock);
+
+	// Keep the load factor under 3/4:
+	if ((entries.size() << 2) >= buckets.size() * 3) grow();
+
+	atom *bucket = findBucket(str, strHash);
+	if (*bucket != 0) return *bucket; // Interned by another thread in between
+
+	*bucket = (atom)entries.size();
+	entries.push_back({.hash = strHash, .str = store(str), .len = (uint32_t)str.size()});
+
+	return *bucket;
+}
+
+string_view name(atom id)
+{
+	shared_lock readLock(lock);
+
+	const entry &e = entries[id];
+	return string_view(e.str, e.len);
+}
+
+uint64_t hash(atom id)
+{
+	shared_lock readLock(lock);
+	return entries[id].hash;
+}
+
+} // namespace intern
+} // namespace engine
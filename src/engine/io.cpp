@@ -1,434 +1,1665 @@
 #include "engine/io.h"
 #include "engine/caaf.h"
+#include "engine/codec.h"
+#include "engine/intern.h"
+#include "engine/jobs.h"
 #include "engine/lzma.h"
+#include "engine/view.h"
 #include <SDL3/SDL_error.h>
+#include <SDL3/SDL_filesystem.h>
 #include <SDL3/SDL_gpu.h>
 #include <SDL3/SDL_iostream.h>
 #include <SDL3/SDL_log.h>
 #include <SDL3/SDL_stdinc.h>
 #include <SDL3/SDL_storage.h>
 #include <SDL3/SDL_timer.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#define EXT_CAAF ".caaf.xz"
-#define EXT_CSAF ".csaf.xz"
+#define EXT_CAAF ".caaf"
+#define EXT_CSAF ".csaf"
+#define EXT_PAK ".pak"
+#define EXT_XZ ".xz"
 
 namespace engine
 {
 namespace io
 {
 
-static unordered_map<string, model::model *> loadedModels;
-static unordered_map<string, SDL_GPUShader *> loadedShaders;
+// A model that is being loaded, published to loadedModels once its uploads are recorded
+typedef struct loading {
+	model::handle modl; // Empty until a load has opened the file
+	shared_ptr<promise<bool>> done;
+	shared_future<bool> result;
+} loading;
+
+// Copy from a transfer buffer recorded by a load
+typedef struct upload {
+	SDL_GPUTransferBufferLocation src;
+	SDL_GPUBufferRegion dst;
+} upload;
+
+// Copy of the levels or layers of a texture recorded by a load
+typedef struct texUpload {
+	SDL_GPUTextureTransferInfo src;
+	SDL_GPUTextureRegion dst;
+} texUpload;
+
+// What a load running on a worker leaves for the thread that owns the copy pass
+typedef struct pendingLoad {
+	intern::atom request; // Name the load was requested by, 0 if it was read from a path
+	uint32_t sections; // Values of loadedSections and streamPayloads when the load was queued
+	bool stream;
+	vector<intern::atom> models; // Loading models opened by this load, including dependencies
+	vector<upload> uploads;
+	vector<texUpload> texUploads;
+	vector<SDL_GPUTexture *> mipmapped; // Textures to generate mipmaps for once they are uploaded
+	vector<gpu::stagingRegion> regions; // Retired once the uploads are recorded
+	shared_ptr<promise<bool>> done; // Only for loads read from a path
+	bool ok;
+	bool uploaded; // Set by finishLoads once the uploads are recorded
+} pendingLoad;
+
+// A cached model or shader in the order they were used
+typedef struct recentUse {
+	intern::atom name;
+	bool shader;
+} recentUse;
+
+// A published model and the bytes it is accounted for in the budgets
+typedef struct cachedModel {
+	model::handle modl;
+	uint64_t lastUse; // Value of useClock when it was last requested
+	uint64_t cpuSize;
+	uint64_t gpuSize;
+	list<recentUse>::iterator use;
+} cachedModel;
+
+// A loaded shader and the backend that created it
+typedef struct cachedShader {
+	SDL_GPUShader *shader;
+	gpu::backend *gpu;
+	uint64_t gpuSize; // Size of the code the shader was created from
+	size_t fileHash; // Of the CSAF file it was loaded from, tells apart shaders loaded again under the same name
+	list<recentUse>::iterator use;
+} cachedShader;
+
+// Only written by the thread that owns the copy pass, workers read it with the lock held
+static unordered_map<intern::atom, cachedModel> loadedModels;
+static unordered_map<intern::atom, loading> loadingModels;
+static unordered_map<intern::atom, cachedShader> loadedShaders;
+
+static unordered_set<intern::atom> prefetching; // Dependencies opened ahead of the models depending on them
+static list<recentUse> recentlyUsed; // Every cached model and shader, the most recently used first
+
+static vector<pendingLoad *> finishedLoads;
+static vector<pendingLoad *> stagedLoads; // Finished, waiting for other loads to fill the staging slots they share
+static vector<pendingLoad *> chainingLoads; // Uploaded, waiting for dependencies that other loads are opening
+static uint32_t runningLoads = 0; // Submitted and not finished yet
+static bool shadersCleared = false; // Cleared while loads were running, released once they are finished
+static mutex cacheLock; // Guards the caches above, the lists of loads and the counters below
+static condition_variable loadFinished;
+
+static uint64_t useClock = 0; // Ticks whenever a cached model is used
+static uint64_t cpuBudget = 0, gpuBudget = 0; // 0 for no limit
+static uint64_t cpuUsed = 0, gpuUsed = 0;
+
+// Written by the setters from any thread, loads copy them when they are queued
+static atomic<bool> streamPayloads = true;
+static atomic<uint32_t> loadedSections = caaf::allSections;
 
 // internal method
-uint8_t *loadCommon(const char *path, const char *root)
+// Moves a cached model or shader to the front of the recently used list, the lock must be held.
+void markUsed(list<recentUse>::iterator use)
 {
-	SDL_Storage *storage = SDL_OpenTitleStorage(root, 0);
+	recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, use);
+}
+
+// Extensions of compressed files, in lookup order. Bare .xz streams predate packs.
+static const char *const packedExts[] = {EXT_PAK, EXT_XZ};
+
+// A file opened by the loader, either readable in place or still compressed.
+typedef struct openedFile {
+	caaf::view *view;
+	uint8_t *packed; // Allocated with SDL_malloc
+	size_t packedSize;
+} openedFile;
+
+// internal method
+// Returns the directory of a storage root, under the base path of the application so that it does not depend on the
+// working directory.
+filesystem::path storageDir(const char *root)
+{
+	const char *base = SDL_GetBasePath();
+	return filesystem::path(base != nullptr ? base : "").append(root);
+}
+
+// internal method
+openedFile loadCommon(const char *path, const char *root)
+{
+	filesystem::path dir = storageDir(root); // Mapped files and title storage are looked up in the same place
+
+	// Map the uncompressed file directly when present:
+	caaf::view *res = caaf::view::map(filesystem::path(dir).append(path).c_str());
+	if (res != nullptr) return {.view = res};
+
+	SDL_Storage *storage = SDL_OpenTitleStorage(dir.c_str(), 0);
 
 	if (!storage) {
 		cerr << SDL_GetError() << endl;
-		return nullptr;
+		return {};
 	}
 
 	while (!SDL_StorageReady(storage))
 		SDL_Delay(1);
 
+	for (const char *ext : packedExts) {
+		string packedPath = string(path) + ext;
+
+		size_t size;
+		if (!SDL_GetStorageFileSize(storage, packedPath.c_str(), &size)) continue;
+
+		uint8_t *packed = (uint8_t *)SDL_malloc(size);
+
+		if (!SDL_ReadStorageFile(storage, packedPath.c_str(), packed, size)) {
+			SDL_free(packed);
+			break;
+		}
+
+		SDL_CloseStorage(storage);
+		return {.packed = packed, .packedSize = size};
+	}
+
+	SDL_CloseStorage(storage);
+	return {};
+}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+
+// internal method
+openedFile readCommon(const char *path, const char *root)
+{
+	filesystem::path file = filesystem::path(root).append(path);
 	size_t size;
-	if (!SDL_GetStorageFileSize(storage, path, &size)) return nullptr;
 
-	uint8_t *xz = new uint8_t[size];
+	if (file.extension() == EXT_PAK || file.extension() == EXT_XZ) {
+		void *packed = SDL_LoadFile(file.c_str(), &size);
+		return {.packed = (uint8_t *)packed, .packedSize = packed != nullptr ? size : 0};
+	}
+
+	caaf::view *res = caaf::view::map(file.c_str());
+	if (res != nullptr) return {.view = res};
 
-	if (!SDL_ReadStorageFile(storage, path, xz, size)) {
-		delete[] xz;
+	for (const char *ext : packedExts) {
+		filesystem::path packedFile = file;
+		packedFile += ext;
+
+		void *packed = SDL_LoadFile(packedFile.c_str(), &size);
+		if (packed != nullptr) return {.packed = (uint8_t *)packed, .packedSize = size};
+	}
+
+	return {};
+}
+
+#endif
+
+// One region of the staging ring holding the payloads of every mesh of a model, mapped once while it is filled
+typedef struct staging {
+	gpu::stagingRegion region; // No transfer buffer until staging began
+	uint8_t *mapped; // Start of the region, nullptr once unmapped
+	vector<uint64_t> offsets; // Of each mesh payload in the region
+	vector<bool> filled; // Payloads that were streamed in
+} staging;
+
+// internal method
+// Lays out the payloads one after the other, then acquires and maps a region of the staging ring.
+bool beginStaging(staging &stage, gpu::backend *gpu, const vector<uint64_t> &sizes)
+{
+	uint64_t total = 0;
+
+	stage.offsets.clear();
+	stage.filled.assign(sizes.size(), false);
+
+	for (uint64_t size : sizes) {
+		stage.offsets.push_back(total);
+		total = (total + size + STAGING_ALIGN - 1) & ~(uint64_t)(STAGING_ALIGN - 1);
+	}
+
+	if (!total || total > UINT32_MAX) return false;
+
+	stage.mapped = gpu->getStaging().acquire(total, stage.region);
+	if (stage.mapped != nullptr) return true;
+
+	stage.region = {};
+	return false;
+}
+
+// internal method
+void endStaging(staging &stage, gpu::backend *gpu)
+{
+	if (stage.mapped != nullptr) gpu->getStaging().unmap(stage.region);
+	stage.mapped = nullptr;
+}
+
+// internal method
+void releaseStaging(staging &stage, gpu::backend *gpu)
+{
+	endStaging(stage, gpu);
+	if (stage.region.transBuf != nullptr) gpu->getStaging().discard(stage.region);
+	stage = {};
+}
+
+// Called by openView once the header and STRT of a file can be read, with the data and size of the whole view
+typedef function<void(const uint8_t *, size_t)> stringsCallback;
+
+// internal method
+// Decompresses a CAAF, writing mesh payloads straight into the mapped staging buffer instead of the view.
+// The staging buffer is left mapped, payloads that could not be streamed are left in the view.
+caaf::view *streamView(const uint8_t *xz, size_t xzSize, gpu::backend *gpu, staging &stage,
+					   const stringsCallback &stringsReady)
+{
+	lzma::decoder dec(xz, xzSize);
+
+	if (!dec.isValid() || dec.getSize() > SIZE_MAX || dec.getSize() < CAAF_SECTION_LIST_POS) return nullptr;
+
+	size_t size = dec.getSize();
+	uint8_t *data;
+
+	// Only the pages that are written take memory, payloads leave holes in the view
+	caaf::view *res = caaf::view::reserve(size, &data);
+	if (res == nullptr) return nullptr;
+
+	// Decompresses into the view up to end, offsets in the view match offsets in the stream
+	auto ensure = [&](uint64_t end) {
+		if (end > size) return false;
+		if (end <= dec.getPosition()) return true;
+
+		uint64_t pos = dec.getPosition();
+		return dec.read(data + pos, end - pos);
+	};
+
+	bool stringsRead = false;
+
+	auto readStrings = [&]() {
+		if (!stringsRead && stringsReady) stringsReady(data, size);
+		stringsRead = true;
+	};
+
+	// Find the MESH entries, nothing has been validated so every read is ensured first
+	bool ok = ensure(CAAF_SECTION_LIST_POS) && ensure(CAAF_SECTION_LIST_POS + res->getHeader().sectCnt * 4);
+	const uint8_t *meshSec = nullptr;
+
+	for (uint16_t i = 0; ok && i < res->getHeader().sectCnt; i++) {
+		const uint8_t *secStart = caaf::getSectionStart(data, i);
+		ok = ensure(secStart - data + sizeof(caaf::secHeader));
+
+		// STRT is the first section, so its strings are in by the time the next one starts
+		if (ok && i == 1) readStrings();
+
+		if (ok && caaf::identifySection(secStart) == caaf::MESH) {
+			meshSec = secStart;
+			break;
+		}
+	}
+
+	// Payload ranges: start, end, entry index
+	vector<tuple<uint64_t, uint64_t, uint32_t>> payloads;
+	uint32_t meshCnt = 0;
+
+	if (ok && meshSec != nullptr) {
+		meshCnt = caaf::getSecEntryCnt(meshSec);
+		ok = ensure(meshSec - data + sizeof(caaf::secHeader) + (uint64_t)meshCnt * 4);
+
+		for (uint32_t j = 0; ok && j < meshCnt; j++) {
+			const uint8_t *entry = caaf::getSecEntryPtr(meshSec, j);
+			ok = ensure(entry - data + sizeof(caaf::mesh));
+
+			if (!ok) break;
+
+			const caaf::mesh &mesh = *(const caaf::mesh *)entry;
+			uint64_t start = entry - data + mesh.meshPtr;
+			payloads.push_back({start, start + mesh.vtxSize + mesh.idxSize, j});
+		}
+	}
+
+	if (ok && !payloads.empty()) {
+		vector<uint64_t> sizes(meshCnt);
+
+		for (auto [start, end, j] : payloads)
+			sizes[j] = end - start;
+
+		// Without a staging buffer every payload is decompressed into the view
+		if (!beginStaging(stage, gpu, sizes)) payloads.clear();
+	}
+
+	if (ok) {
+		// Overlapping payloads are shared, so they are left in the view
+		sort(payloads.begin(), payloads.end());
+		vector<bool> streamable(payloads.size(), true);
+		size_t maxIdx = 0;
+
+		for (size_t i = 1; i < payloads.size(); i++) {
+			if (get<0>(payloads[i]) < get<1>(payloads[maxIdx])) {
+				streamable[i] = false;
+				streamable[maxIdx] = false;
+			}
+
+			if (get<1>(payloads[i]) > get<1>(payloads[maxIdx])) maxIdx = i;
+		}
+
+		for (size_t i = 0; ok && i < payloads.size(); i++) {
+			auto [start, end, j] = payloads[i];
+
+			// Already decompressed, empty or out of bounds (rejected later by validation)
+			if (!streamable[i] || start < dec.getPosition() || start == end || end > size) continue;
+
+			ok = ensure(start) && dec.read(stage.mapped + stage.offsets[j], end - start);
+			stage.filled[j] = ok;
+		}
+	}
+
+	if (ok && ensure(size) && dec.finish()) {
+		readStrings();
+		return res;
+	}
+
+	releaseStaging(stage, gpu);
+	delete res;
+	return nullptr;
+}
+
+// internal method
+// Returns a readable view of an opened file, decompressing it if needed. Frees the compressed data.
+// Mesh payloads are streamed into a staging buffer when stage is given.
+// Only the chunks of the sections in the mask are decompressed from chunked packs.
+// stringsReady is called once the strings can be read, before the rest of the file is when the format allows it.
+caaf::view *openView(openedFile file, gpu::backend *gpu, staging *stage, uint32_t sections,
+					 const stringsCallback &stringsReady = {})
+{
+	if (file.packed == nullptr) {
+		if (file.view != nullptr && stringsReady) stringsReady(file.view->getData(), file.view->getSize());
+		return file.view;
+	}
+
+	caaf::view *res = nullptr;
+
+	codec::id codec;
+	const uint8_t *payload;
+	size_t payloadSize;
+	const codec::chunk *chunks;
+	uint16_t chunkCnt;
+
+	if (!codec::identify(file.packed, file.packedSize, &codec, &payload, &payloadSize) ||
+		!codec::getChunks(file.packed, file.packedSize, &chunks, &chunkCnt)) {
+		SDL_free(file.packed);
 		return nullptr;
 	}
 
-	SDL_CloseStorage(storage);
+	if (chunkCnt) {
+		// Chunks that are skipped leave zeroed holes in the view, which cost no memory
+		uint64_t size = ((const codec::header *)file.packed)->size;
+		uint8_t *data;
+
+		if (size <= SIZE_MAX) res = caaf::view::reserve(size, &data);
+
+		// STRT and shared chunks first, then the rest of the sections
+		uint32_t strings = caaf::sectionBit(caaf::STRT);
+		bool ok = res != nullptr && codec::decompressChunks(file.packed, file.packedSize, data, strings);
 
-	// Decompress XZ:
-	uint8_t *res = lzma::decompress(xz, &size);
-	delete[] xz;
+		if (ok && stringsReady) stringsReady(data, size);
+		if (ok) ok = codec::decompressChunks(file.packed, file.packedSize, data, sections & ~strings, false);
+
+		if (res != nullptr && !ok) {
+			delete res;
+			res = nullptr;
+		}
+	} else if (codec == codec::xz && stage != nullptr && sections & caaf::sectionBit(caaf::MESH))
+		res = streamView(payload, payloadSize, gpu, *stage, stringsReady); // Only xz reads payloads in order
+	else {
+		// Decompress, the view adopts the decompressed buffer:
+		size_t size = file.packedSize;
+		uint8_t *data = codec::decompress(file.packed, &size);
+
+		if (data != nullptr) res = new caaf::view(data, size);
+		if (res != nullptr && stringsReady) stringsReady(data, size);
+	}
 
+	SDL_free(file.packed);
 	return res;
 }
 
-#ifdef CAAF_ENABLE_DEBUG_TOOLS
+// internal method
+// Sets codeSize to the size of the code the shader was created from.
+SDL_GPUShader *loadShader(const uint8_t *csaf, size_t csafSize, gpu::backend *gpu, size_t &codeSize)
+{
+	// Possible errors: out of bounds data, magic number does not match or version does not match
+	if (!csaf::validate(csaf, csafSize) || ((const csaf::header *)csaf)->version != CSAF_VERSION) return nullptr;
+
+	const csaf::header &header = *(const csaf::header *)csaf;
+
+	SDL_GPUShaderFormat formats = header.shaderFormats;
+	SDL_GPUShaderFormat targetFormat = resolvePlatformShaderFormat(formats, gpu);
+
+	if (targetFormat == SDL_GPU_SHADERFORMAT_INVALID) return nullptr;
+
+	auto [code, size] = csaf::getShaderCode(csaf, formats, targetFormat);
+	codeSize = size;
+
+	SDL_GPUShaderCreateInfo info = {.code_size = size,
+									.code = code,
+									.entrypoint = targetFormat == SDL_GPU_SHADERFORMAT_MSL ? "main0" : "main",
+									.format = targetFormat,
+									.stage = (SDL_GPUShaderStage)header.stage,
+									.num_samplers = header.sampleCnt,
+									.num_storage_textures = header.storageTexCnt,
+									.num_storage_buffers = header.storageBufCnt,
+									.num_uniform_buffers = header.uniformBufCnt};
+
+	return gpu->createShader(info);
+}
 
 // internal method
-uint8_t *readCommon(const char *path, const char *root)
+// Returns a cached shader or loads it, nullptr if it could not be loaded.
+// Sets fileHash, if not nullptr, to the hash of the file the shader was loaded from.
+SDL_GPUShader *getShader(intern::atom name, gpu::backend *gpu, size_t *fileHash = nullptr)
 {
-	filesystem::path file = filesystem::path(root).append(path);
+	if (name == 0) return nullptr;
 
-	size_t size;
-	void *xz = SDL_LoadFile(file.c_str(), &size);
+	{
+		lock_guard guard(cacheLock);
+
+		auto it = loadedShaders.find(name);
+
+		if (it != loadedShaders.end()) {
+			markUsed(it->second.use);
+			if (fileHash != nullptr) *fileHash = it->second.fileHash;
+			return it->second.shader;
+		}
+	}
+
+	string path = string(intern::name(name)) + EXT_CSAF;
+	caaf::view *csaf = openView(loadCommon(path.c_str(), STORAGE_CSAF_ROOT), gpu, nullptr, caaf::allSections);
+
+	if (csaf == nullptr) return nullptr;
+
+	size_t codeSize = 0;
+	SDL_GPUShader *res = loadShader(csaf->getData(), csaf->getSize(), gpu, codeSize);
+	size_t hashed = hash<string_view>()(string_view((const char *)csaf->getData(), csaf->getSize()));
+	delete csaf;
+
+	if (res == nullptr) return nullptr;
+
+	lock_guard guard(cacheLock);
+	auto [it, inserted] = loadedShaders.try_emplace(name, res, gpu, codeSize, hashed);
+
+	// Loaded by another worker in between
+	if (!inserted) gpu->releaseShader(res);
+	else {
+		it->second.use = recentlyUsed.insert(recentlyUsed.begin(), {.name = name, .shader = true});
+		gpuUsed += codeSize;
+	}
+
+	if (fileHash != nullptr) *fileHash = it->second.fileHash;
+	return it->second.shader;
+}
+
+// internal method
+// Sets the dependency of a model, the lock must be held. A dependency that depends on the model itself is refused,
+// the handles of a circular chain would keep each other alive. Chains are never circular, so the walk ends.
+void linkDependency(model::model *modl, model::model *dep)
+{
+	for (const model::model *it = dep; it != nullptr; it = it->dependsOn.get())
+		if (it == modl) {
+			cerr << "Warning: circular dependency between " << modl->name << " and " << dep->name << endl;
+			return;
+		}
 
-	// Decompress XZ:
-	uint8_t *res = lzma::decompress((uint8_t *)xz, &size);
-	SDL_free(xz);
+	modl->dependsOn = model::handle(dep);
+}
+
+// internal method
+// Sets the dependency of a model to one that is loaded or that a load has opened, returns it or nullptr if there is
+// none. Set with the lock held so that the dependency cannot be evicted in between.
+model::model *findDependency(intern::atom name, model::model *modl)
+{
+	lock_guard guard(cacheLock);
+
+	auto loaded = loadedModels.find(name);
+	auto it = loadingModels.find(name);
+	model::model *res = nullptr;
+
+	if (loaded != loadedModels.end()) {
+		loaded->second.lastUse = ++useClock;
+		markUsed(loaded->second.use);
+		res = loaded->second.modl.get();
+	} else if (it != loadingModels.end()) res = it->second.modl.get();
+
+	if (res != nullptr) linkDependency(modl, res);
 
 	return res;
 }
 
-#endif
+// internal method
+// Adds a new entry for a model that is being loaded, the lock must be held.
+loading &addLoading(intern::atom name)
+{
+	loading &res = loadingModels[name];
+
+	res.done = make_shared<promise<bool>>();
+	res.result = res.done->get_future().share();
+
+	return res;
+}
+
+// internal method
+// Returns the model a load registered under a name, nullptr if there is none. The lock must be held.
+model::model *findLoading(intern::atom name)
+{
+	auto it = loadingModels.find(name);
+	return it != loadingModels.end() ? it->second.modl.get() : nullptr;
+}
 
 // internal method
-model::model *loadModel(uint8_t *caaf, const char *root, uint8_t *(*depsFunc)(const char *, const char *),
-						SDL_GPUDevice *device, SDL_GPUCopyPass *pass)
+// Registers a model opened by a load under its name.
+// Returns the model another load already registered under that name instead, if any.
+model::model *registerModel(intern::atom name, model::model *modl, pendingLoad &load)
 {
-	caaf::header header = *(caaf::header *)caaf;
+	lock_guard guard(cacheLock);
 
-	// Possible errors: magic number does not match, version does not match, no sections (at least STRT is required)
-	if (string(header.magic) != CAAF_HEADER_MAGIC || header.version != CAAF_VERSION || !header.sectCnt) return nullptr;
+	auto loaded = loadedModels.find(name);
+	if (loaded != loadedModels.end()) return loaded->second.modl.get();
 
-	model::model *modl = new model::model();
+	auto it = loadingModels.find(name);
+	loading &entry = it != loadingModels.end() ? it->second : addLoading(name);
 
-	uint8_t *strSec = caaf::getSectionStart(caaf, 0);
+	if (entry.modl) return entry.modl.get();
 
-	if (caaf::identifySection(strSec) != caaf::section::STRT) {
-		cerr << "Malformed CAAF: STRT was not the first section." << endl;
-		return modl;
+	entry.modl = model::handle(modl);
+	load.models.push_back(name);
+
+	return modl;
+}
+
+// A dependency loaded on a worker while the model depending on it is still being opened
+typedef struct prefetch {
+	intern::atom name;
+	pendingLoad load; // Merged into the load of the dependent model once joined
+	model::model *modl; // Set by the task, nullptr if the dependency could not be loaded
+	jobs::task task;
+} prefetch;
+
+// internal method
+// Reads the name of the dependency of a CAAF of which only the header and STRT may be readable yet.
+// Returns 0 if there is none or the strings are not valid, the file is validated again once it is read.
+intern::atom peekDependency(const uint8_t *data, size_t size)
+{
+	uint32_t strings = caaf::sectionBit(caaf::STRT);
+	caaf::directory dir;
+
+	if (!caaf::validate(data, size, strings) || !caaf::buildDirectory(data, &dir, strings)) return 0;
+
+	const caaf::header &header = *(const caaf::header *)data;
+	const caaf::dirEntry &strSec = dir.sections[caaf::STRT];
+
+	if (header.version != CAAF_VERSION) return 0;
+
+	return intern::get(caaf::getStringView(strSec.start, header.depIdx, strSec.count - 1));
+}
+
+model::model *loadModel(openedFile opened, const char *root, openedFile (*depsFunc)(const char *, const char *),
+						gpu::backend *gpu, pendingLoad &load);
+
+// internal method
+// Starts loading a dependency on a worker, unless it is loaded, being loaded or already prefetched.
+// The dependency is loaded with the settings of the load depending on it.
+shared_ptr<prefetch> startPrefetch(intern::atom name, const char *root,
+								   openedFile (*depsFunc)(const char *, const char *), gpu::backend *gpu,
+								   const pendingLoad &parent)
+{
+	{
+		lock_guard guard(cacheLock);
+
+		if (loadedModels.contains(name) || loadingModels.contains(name) || !prefetching.insert(name).second)
+			return nullptr;
+	}
+
+	shared_ptr<prefetch> res = make_shared<prefetch>();
+	res->name = name;
+	res->load = {.request = 0, .sections = parent.sections, .stream = parent.stream, .ok = false};
+
+	res->task = jobs::task([pre = res.get(), root = string(root), depsFunc, gpu]() {
+		string file = string(intern::name(pre->name)) + EXT_CAAF; // Add file extension
+		openedFile depsFile = depsFunc(file.c_str(), root.c_str());
+
+		pre->modl = nullptr;
+
+		if (depsFile.view != nullptr || depsFile.packed != nullptr)
+			pre->modl = loadModel(depsFile, root.c_str(), depsFunc, gpu, pre->load);
+
+		lock_guard guard(cacheLock);
+		prefetching.erase(pre->name);
+	});
+
+	return res;
+}
+
+// internal method
+// Waits for a prefetched dependency and hands what its load opened over to the load of the dependent model.
+model::model *joinPrefetch(prefetch &pre, pendingLoad &load)
+{
+	pre.task.join();
+
+	load.models.insert(load.models.end(), pre.load.models.begin(), pre.load.models.end());
+	load.uploads.insert(load.uploads.end(), pre.load.uploads.begin(), pre.load.uploads.end());
+	load.texUploads.insert(load.texUploads.end(), pre.load.texUploads.begin(), pre.load.texUploads.end());
+	load.mipmapped.insert(load.mipmapped.end(), pre.load.mipmapped.begin(), pre.load.mipmapped.end());
+	load.regions.insert(load.regions.end(), pre.load.regions.begin(), pre.load.regions.end());
+
+	pre.load = {};
+	return pre.modl;
+}
+
+// internal method
+// Returns whether the mip levels of a texture are stored in its data rather than generated, only block compressed
+// formats store them since they cannot be rendered into.
+bool storesMipLevels(const caaf::texture &texture)
+{
+	return texture.mipLvls > 1 && gpu::isBlockCompressed((SDL_GPUTextureFormat)texture.format);
+}
+
+// internal method
+// Returns the size of one mip level of a texture, every layer included.
+uint64_t levelSize(const caaf::texture &texture, uint32_t level)
+{
+	bool volume = texture.type == SDL_GPU_TEXTURETYPE_3D;
+
+	return SDL_CalculateGPUTextureFormatSize((SDL_GPUTextureFormat)texture.format, max(texture.width >> level, 1u),
+											 max(texture.height >> level, 1u),
+											 volume ? max(texture.depth >> level, 1u) : texture.depth);
+}
+
+// internal method
+// Returns the size of the data of a texture, 0 if the texture is empty, its format unknown or its data out of bounds.
+// Stored mip levels follow each other from the largest one.
+uint64_t textureSize(const caaf::texture &texture, const caaf::view &caaf)
+{
+	if (!texture.width || !texture.height || !texture.depth) return 0;
+
+	uint32_t levels = storesMipLevels(texture) ? texture.mipLvls : 1;
+	uint64_t size = 0;
+
+	for (uint32_t level = 0; level < levels; level++) {
+		uint64_t lvlSize = levelSize(texture, level);
+		if (!lvlSize) return 0;
+		size += lvlSize;
 	}
 
-	uint16_t strLimit = caaf::getSecEntryCnt(strSec) - 1;
+	uint64_t offset = (const uint8_t *)&texture + texture.dataPtr - caaf.getData();
 
-	modl->name = caaf::getString(strSec, header.nameIdx, strLimit);
-	string dependency = caaf::getString(strSec, header.depIdx, strLimit);
+	return offset + size <= caaf.getSize() ? size : 0;
+}
 
-	loadedModels[modl->name] = modl; // Prevents circular dependency infinite loop
+// internal method
+// Creates the textures of a model and records their uploads, the data of every texture goes through one region of
+// the staging ring.
+void loadTextures(caaf::view &caaf, model::model *modl, gpu::backend *gpu, pendingLoad &load)
+{
+	caaf::entryRange<caaf::TEXD> textures = caaf.entries<caaf::TEXD>();
+	modl->textureCnt = textures.size();
+
+	if (!modl->textureCnt) return;
+
+	modl->textures = new SDL_GPUTexture *[modl->textureCnt]();
+
+	vector<uint64_t> sizes;
+
+	for (const caaf::texture &texture : textures)
+		sizes.push_back(textureSize(texture, caaf));
+
+	staging stage = {};
+
+	if (!beginStaging(stage, gpu, sizes)) {
+		cerr << "Could not stage the textures of " << modl->name << endl;
+		return;
+	}
 
-	// Try get dependency from cache
-	if (!dependency.empty()) {
-		model::model *depsModel = loadedModels[dependency];
+	for (uint32_t j = 0; j < textures.size(); j++) {
+		const caaf::texture &texture = textures[j];
 
-		string file = dependency + EXT_CAAF; // Add file extension
+		if (!sizes[j]) {
+			cerr << "Warning: texture " << j << " of model " << modl->name << " is empty or out of bounds." << endl;
+			continue;
+		}
 
-		// Load if not already loaded
-		if (depsModel == nullptr) {
-			uint8_t *depsCaaf = depsFunc(file.c_str(), root);
+		SDL_GPUTextureCreateInfo info = {.type = (SDL_GPUTextureType)texture.type,
+										 .format = (SDL_GPUTextureFormat)texture.format,
+										 .usage = SDL_GPU_TEXTUREUSAGE_SAMPLER,
+										 .width = texture.width,
+										 .height = texture.height,
+										 .layer_count_or_depth = texture.depth,
+										 .num_levels = texture.mipLvls ? texture.mipLvls : 1u,
+										 .props = texture.props};
+
+		// Mip levels are generated by rendering into them, unless they are stored
+		bool stored = storesMipLevels(texture);
+		bool generated = texture.mipLvls > 1 && !stored;
+
+		if (generated) {
+			info.usage |= SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+
+			if (!gpu->supportsTextureFormat(info.format, info.type, info.usage)) {
+				cerr << "Warning: mipmaps of texture " << j << " of model " << modl->name
+					 << " cannot be generated in its format." << endl;
+				info.usage = SDL_GPU_TEXTUREUSAGE_SAMPLER;
+				info.num_levels = 1;
+				generated = false;
+			}
+		}
+
+		SDL_GPUTexture *res = gpu->createTexture(info);
+
+		if (res == nullptr) {
+			cerr << SDL_GetError() << endl;
+			continue;
+		}
 
-			if (depsCaaf == nullptr)
-				cerr << "Warning: could not find dependency " << dependency << " of model " << modl->name << endl;
-			else {
-				depsModel = loadModel(depsCaaf, root, depsFunc, device, pass);
-				delete[] depsCaaf;
+		modl->textures[j] = res;
+		modl->textureBytes += generated ? sizes[j] + sizes[j] / 3 : sizes[j];
+
+		memcpy(stage.mapped + stage.offsets[j], (const uint8_t *)&texture + texture.dataPtr, sizes[j]);
+
+		// Volumes are copied at once, the layers of other types one by one
+		bool volume = info.type == SDL_GPU_TEXTURETYPE_3D;
+		uint32_t layers = volume ? 1 : texture.depth;
+		uint64_t offset = stage.offsets[j];
+
+		for (uint32_t level = 0; level < (stored ? texture.mipLvls : 1u); level++) {
+			uint32_t width = max(texture.width >> level, 1u);
+			uint32_t height = max(texture.height >> level, 1u);
+			uint64_t layerSize = levelSize(texture, level) / layers;
+
+			for (uint32_t layer = 0; layer < layers; layer++) {
+				SDL_GPUTextureTransferInfo src = {.transfer_buffer = stage.region.transBuf,
+												  .offset = stage.region.offset + (uint32_t)offset,
+												  .pixels_per_row = width,
+												  .rows_per_layer = height};
+				SDL_GPUTextureRegion dst = {.texture = res,
+											.mip_level = level,
+											.layer = layer,
+											.w = width,
+											.h = height,
+											.d = volume ? max(texture.depth >> level, 1u) : 1};
+
+				load.texUploads.push_back({.src = src, .dst = dst});
+				offset += layerSize;
 			}
 		}
 
-		modl->dependsOn = depsModel;
+		if (generated) load.mipmapped.push_back(res);
 	}
 
-	bool meshesReached = false;
+	// Retired once the uploads are recorded
+	endStaging(stage, gpu);
+	load.regions.push_back(stage.region);
+}
 
-	for (uint16_t i = 1; i < header.sectCnt; i++) {
-		uint8_t *secStart = caaf::getSectionStart(caaf, i);
-		caaf::section secType = caaf::identifySection(secStart);
-		uint16_t secCnt = caaf::getSecEntryCnt(strSec);
+// internal method
+// Appends the bytes of a value to a pipeline or sampler cache key.
+template <typename T> void appendKey(string &key, const T &value)
+{
+	key.append((const char *)&value, sizeof(T));
+}
 
-		switch (secType) {
-			case caaf::unknown:
-				cerr << "Unknown section \"" << string((char *)secStart, 4) << "\" found at: " << secStart - caaf
-					 << endl;
-				continue;
+// internal method
+// Loads an opened file, its dependency may have been prefetched while it was decompressed.
+// The prefetch is joined once the dependency is needed, the caller joins it if the model failed to load before.
+model::model *loadOpened(openedFile opened, const char *root, openedFile (*depsFunc)(const char *, const char *),
+						 gpu::backend *gpu, pendingLoad &load, shared_ptr<prefetch> &pre)
+{
+	staging stage = {}; // Filled while decompressing if payloads are streamed
 
-			case caaf::STRT:
-				cerr << "Malformed CAAF: Duplicated string table." << endl;
-				return modl;
+	// The dependency is loaded on another worker as soon as its name is known
+	auto prefetchDependency = [&](const uint8_t *data, size_t size) {
+		intern::atom dependency = peekDependency(data, size);
+		if (dependency != 0) pre = startPrefetch(dependency, root, depsFunc, gpu, load);
+	};
 
-			case caaf::MESH:
-			case caaf::GFXP:
-				if (meshesReached && modl->meshCnt != secCnt) { // MESH or GFXP found before.
-					modl->meshCnt = 0;
-					cerr << "Malformed CAAF: MESH and GFXP have different lengths.";
-					return modl;
-				}
+	caaf::view *caaf = openView(opened, gpu, load.stream ? &stage : nullptr, load.sections, prefetchDependency);
+
+	if (caaf == nullptr) return nullptr;
+
+	auto releaseStaged = [&]() { releaseStaging(stage, gpu); };
+
+	// Every access below is unchecked, so bounds are validated once here
+	if (!caaf->validate(load.sections)) {
+		cerr << "Malformed CAAF: data out of bounds, STRT was not the first section or a section is duplicated."
+			 << endl;
+		releaseStaged();
+		delete caaf;
+		return nullptr;
+	}
+
+	const caaf::header &header = caaf->getHeader();
+
+	// Possible errors: version does not match, no sections (at least STRT is required)
+	if (header.version != CAAF_VERSION || !header.sectCnt) {
+		releaseStaged();
+		delete caaf;
+		return nullptr;
+	}
+
+	model::model *modl = new model::model(gpu);
+	modl->source = caaf;
+
+	if (caaf->getDirectory().unknownCnt)
+		cerr << "Warning: " << caaf->getDirectory().unknownCnt << " unknown sections were ignored." << endl;
+
+	const uint8_t *strSec = caaf->getSection(caaf::STRT).start;
+	uint16_t strLimit = caaf->getSection(caaf::STRT).count - 1;
+
+	string_view name = caaf::getStringView(strSec, header.nameIdx, strLimit);
+	intern::atom dependency = intern::get(caaf::getStringView(strSec, header.depIdx, strLimit));
+
+	modl->name = name;
+	modl->isDependency = header.isDep;
+
+	// Set before the model is registered, models depending on it index past these entries. Counted from every section,
+	// including the ones left out of this load, since the indices of dependents do not depend on what was loaded.
+	caaf::directory fullDir;
+	caaf::buildDirectory(caaf->getData(), &fullDir);
+
+	for (uint8_t i = 0; i < caaf::sectionCnt; i++)
+		modl->entryCnts[i] = fullDir.sections[i].count;
+
+	// Registered before its dependencies are loaded, which prevents circular dependency infinite loop
+	model::model *registered = registerModel(intern::get(name), modl, load);
+
+	if (registered != modl) {
+		releaseStaged();
+		delete modl;
+		return registered;
+	}
+
+	// Try get dependency from cache, dependencies other loads are loading are not waited for
+	bool prefetched = false;
+
+	if (dependency != 0) {
+		model::model *depsModel = findDependency(dependency, modl);
 
-				modl->meshCnt = secCnt;
-				meshesReached = true;
-				break;
+		// Joined even when its load registered it already, the dependency only has its chain once that load is done
+		prefetched = pre != nullptr && pre->name == dependency;
 
-			default:
-				break;
+		// Load if not already loaded or being prefetched
+		if (depsModel == nullptr && !prefetched) {
+			string file = string(intern::name(dependency)) + EXT_CAAF; // Add file extension
+			openedFile depsFile = depsFunc(file.c_str(), root);
+
+			if (depsFile.view == nullptr && depsFile.packed == nullptr)
+				cerr << "Warning: could not find dependency " << intern::name(dependency) << " of model "
+					 << modl->name << endl;
+			else
+				depsModel = loadModel(depsFile, root, depsFunc, gpu, load);
+
+			lock_guard guard(cacheLock);
+			linkDependency(modl, depsModel);
 		}
+	}
 
-		if (modl->meshCnt)
-			modl->meshes = new model::mesh[modl->meshCnt];
-		else
-			modl->meshes = nullptr;
+	// A prefetched dependency is only waited for once it is needed, the chain is built once the dependency is linked
+	auto joinDependency = [&]() {
+		model::model *depsModel = nullptr;
 
-		for (uint16_t j = 0; j < secCnt; j++) {
-			uint8_t *entryPtr = caaf::getSecEntryPtr(secStart, j);
+		if (prefetched) {
+			depsModel = joinPrefetch(*pre, load);
+			pre = nullptr;
 
-			switch (secType) {
-				case caaf::MESH: {
-					caaf::mesh mesh = *(caaf::mesh *)entryPtr;
+			if (depsModel == nullptr && !modl->dependsOn)
+				cerr << "Warning: could not find dependency " << intern::name(dependency) << " of model "
+					 << modl->name << endl;
+		}
 
-					uint8_t *meshStart = entryPtr + mesh.meshPtr;
-					uint32_t meshSize = mesh.vtxSize + mesh.idxSize;
+		lock_guard guard(cacheLock);
 
-					uint8_t *vbdStart = entryPtr + mesh.vbdPtr;
-					uint16_t vbdCount = caaf::getSubEntryCnt(vbdStart);
+		if (depsModel != nullptr) linkDependency(modl, depsModel);
 
-					SDL_GPUTransferBufferCreateInfo transInfo = {.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-																 .size = meshSize};
-					SDL_GPUTransferBuffer *transBuf = SDL_CreateGPUTransferBuffer(device, &transInfo);
+		// Left to finishLoads while another load is still opening the dependency
+		if (!modl->dependsOn || modl->dependsOn->chain != nullptr) modl->buildChain();
+	};
 
-					if (transBuf == nullptr) {
-						cerr << SDL_GetError() << endl;
-						continue;
-					}
+	const caaf::dirEntry &meshSec = caaf->getSection(caaf::MESH), &gfxpSec = caaf->getSection(caaf::GFXP);
 
-					void *mappedMem = SDL_MapGPUTransferBuffer(device, transBuf, false);
+	if (meshSec.start != nullptr && gfxpSec.start != nullptr && meshSec.count != gfxpSec.count) {
+		cerr << "Malformed CAAF: MESH and GFXP have different lengths." << endl;
+		releaseStaged();
+		joinDependency();
+		return modl;
+	}
 
-					if (mappedMem == nullptr) {
-						cerr << SDL_GetError() << endl;
-						SDL_ReleaseGPUTransferBuffer(device, transBuf);
-						continue;
-					}
+	// Streaming staged the entries it found before validation, the loop below relies on them being the same
+	if (stage.region.transBuf != nullptr && stage.offsets.size() != meshSec.count) {
+		cerr << "Malformed CAAF: MESH entries do not match the streamed payloads." << endl;
+		releaseStaged();
+		joinDependency();
+		return modl;
+	}
 
-					memcpy(mappedMem, meshStart, meshSize);
-					SDL_UnmapGPUTransferBuffer(device, transBuf);
+	modl->meshCnt = meshSec.start != nullptr ? meshSec.count : gfxpSec.count;
 
-					SDL_GPUBufferCreateInfo vtxInfo = {.usage = SDL_GPU_BUFFERUSAGE_VERTEX, .size = mesh.vtxSize};
-					SDL_GPUBuffer *vtxBuf = SDL_CreateGPUBuffer(device, &vtxInfo);
+	if (modl->meshCnt) {
+		modl->meshes = new model::mesh[modl->meshCnt]();
+		modl->pipelines = new SDL_GPUGraphicsPipeline *[modl->meshCnt]();
+	}
 
-					if (vtxBuf == nullptr) {
-						cerr << SDL_GetError() << endl;
-						SDL_ReleaseGPUTransferBuffer(device, transBuf);
-						continue;
-					}
+	caaf::entryRange<caaf::MESH> meshes = caaf->entries<caaf::MESH>();
 
-					SDL_GPUBufferCreateInfo idxInfo = {.usage = SDL_GPU_BUFFERUSAGE_INDEX, .size = mesh.idxSize};
-					SDL_GPUBuffer *idxBuf = SDL_CreateGPUBuffer(device, &idxInfo);
+	// Every payload goes through one staging buffer, mapped once, unless streaming already created it
+	if (stage.region.transBuf == nullptr && meshes.size()) {
+		vector<uint64_t> sizes;
 
-					if (idxBuf == nullptr) {
-						cerr << SDL_GetError() << endl;
-						SDL_ReleaseGPUTransferBuffer(device, transBuf);
-						continue;
-					}
+		for (const caaf::mesh &mesh : meshes)
+			sizes.push_back((uint64_t)mesh.vtxSize + mesh.idxSize);
 
-					SDL_GPUTransferBufferLocation src = {.transfer_buffer = transBuf, .offset = 0};
-					SDL_GPUBufferRegion dst = {.buffer = vtxBuf, .offset = 0, .size = mesh.vtxSize};
-					SDL_UploadToGPUBuffer(pass, &src, &dst, false);
+		if (!beginStaging(stage, gpu, sizes)) cerr << "Could not stage the meshes of " << modl->name << endl;
+	}
 
-					src.offset = mesh.vtxSize;
-					dst.buffer = idxBuf;
-					dst.size = mesh.idxSize;
-					SDL_UploadToGPUBuffer(pass, &src, &dst, false);
+	for (uint32_t j = 0; j < meshes.size() && stage.region.transBuf != nullptr; j++) {
+		const caaf::mesh &mesh = meshes[j];
 
-					SDL_ReleaseGPUTransferBuffer(device, transBuf);
-					transBuf = nullptr;
+		const uint8_t *meshStart = (const uint8_t *)&mesh + mesh.meshPtr;
+		uint64_t meshOffset = stage.offsets[j];
 
-					model::mesh *mmesh = &modl->meshes[j];
+		caaf::subRange<caaf::vtxBufData> vbds = caaf::getSubsection<caaf::MESH, caaf::vtxBufData>(mesh);
+		uint16_t vbdCount = vbds.size();
 
-					mmesh->vtxBuf = vtxBuf;
-					mmesh->idxBuf = idxBuf;
-					mmesh->vtxOffsCnt = vbdCount;
-					mmesh->vtxOffsets = nullptr;
+		// Streamed payloads were decompressed straight into the staging buffer
+		bool streamed = stage.filled[j];
+		if (!streamed) memcpy(stage.mapped + meshOffset, meshStart, (uint64_t)mesh.vtxSize + mesh.idxSize);
 
-					if (vbdCount) {
-						mmesh->vtxOffsets = new uint32_t[vbdCount];
-						memcpy(mmesh->vtxOffsets, caaf::getSubEntryPtr(vbdStart, 0), vbdCount * sizeof(uint32_t));
-					}
+		gpu::bufferRange vtx, idx;
+
+		if (!gpu->getVertexHeap().allocate(mesh.vtxSize, vtx)) {
+			cerr << SDL_GetError() << endl;
+			continue;
+		}
+
+		if (!gpu->getIndexHeap().allocate(mesh.idxSize, idx)) {
+			cerr << SDL_GetError() << endl;
+			gpu->getVertexHeap().free(vtx);
+			continue;
+		}
+
+		SDL_GPUTransferBufferLocation src = {.transfer_buffer = stage.region.transBuf,
+											 .offset = stage.region.offset + (uint32_t)meshOffset};
+		load.uploads.push_back({.src = src, .dst = {.buffer = vtx.buffer, .offset = vtx.offset, .size = vtx.size}});
+
+		src.offset += mesh.vtxSize;
+		load.uploads.push_back({.src = src, .dst = {.buffer = idx.buffer, .offset = idx.offset, .size = idx.size}});
+
+		model::mesh *mmesh = &modl->meshes[j];
+
+		mmesh->vtx = vtx;
+		mmesh->idx = idx;
+		mmesh->vtxOffsCnt = vbdCount;
+		mmesh->vtxOffsets = nullptr;
+
+		if (vbdCount) {
+			mmesh->vtxOffsets = new uint32_t[vbdCount];
+
+			for (uint16_t i = 0; i < vbdCount; i++)
+				mmesh->vtxOffsets[i] = vbds[i].start;
+		}
 
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
-					mmesh->vtxSize = mesh.vtxSize;
-					mmesh->idxSize = mesh.idxSize;
-					mmesh->vtxData = new uint8_t[mesh.vtxSize];
-					mmesh->idxData = new uint8_t[mesh.idxSize];
+		mmesh->vtxData = streamed ? nullptr : meshStart; // Points into the model's source view
+		mmesh->idxData = streamed ? nullptr : meshStart + mesh.vtxSize;
+#endif
+	}
+
+	// Retired once the uploads are recorded
+	endStaging(stage, gpu);
+	if (stage.region.transBuf != nullptr) load.regions.push_back(stage.region);
+
+	caaf::entryRange<caaf::GFXP> pipelines = caaf->entries<caaf::GFXP>();
+
+	for (uint32_t j = 0; j < pipelines.size(); j++) {
+		const caaf::gfxPip &gfxpip = pipelines[j];
+		intern::atom vertName = intern::get(caaf::getStringView(strSec, gfxpip.vertNameIdx, strLimit));
+		intern::atom fragName = intern::get(caaf::getStringView(strSec, gfxpip.fragNameIdx, strLimit));
+
+		SDL_GPUGraphicsPipelineCreateInfo info = {};
+		size_t vertHash = 0, fragHash = 0;
+
+		info.vertex_shader = getShader(vertName, gpu, &vertHash);
+		info.fragment_shader = getShader(fragName, gpu, &fragHash);
+
+		info.primitive_type = (SDL_GPUPrimitiveType)gfxpip.primType;
+
+		info.rasterizer_state = {.fill_mode = (SDL_GPUFillMode)gfxpip.fillMod,
+								 .cull_mode = (SDL_GPUCullMode)gfxpip.cullMod,
+								 .front_face = (SDL_GPUFrontFace)gfxpip.frontFace,
+								 .depth_bias_constant_factor = gfxpip.depthBiasConst,
+								 .depth_bias_clamp = gfxpip.depthBiasClamp,
+								 .depth_bias_slope_factor = gfxpip.depthBiasSlope,
+								 .enable_depth_bias = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDBIAS),
+								 .enable_depth_clip = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDCLIP)};
+
+		info.multisample_state = {.sample_count = (SDL_GPUSampleCount)gfxpip.msCnt,
+								  // FIXME: Uncomment once SDL supports it
+								  //.sample_mask = gfxpip.msMask,
+								  //.enable_mask = (bool)(gfxpip.enFlags & CAAF_CTB_ENMASK),
+								  .enable_alpha_to_coverage = (bool)(gfxpip.enFlags & CAAF_GFXP_ENA2COV)};
+
+		info.depth_stencil_state = {
+			.compare_op = (SDL_GPUCompareOp)gfxpip.compOp,
+			.back_stencil_state = {.fail_op = (SDL_GPUStencilOp)gfxpip.bckFailOp,
+								   .pass_op = (SDL_GPUStencilOp)gfxpip.bckPassOp,
+								   .depth_fail_op = (SDL_GPUStencilOp)gfxpip.bckDFailOp,
+								   .compare_op = (SDL_GPUCompareOp)gfxpip.bckCompOp},
+			.front_stencil_state = {.fail_op = (SDL_GPUStencilOp)gfxpip.fntFailOp,
+									.pass_op = (SDL_GPUStencilOp)gfxpip.fntPassOp,
+									.depth_fail_op = (SDL_GPUStencilOp)gfxpip.fntDFailOp,
+									.compare_op = (SDL_GPUCompareOp)gfxpip.fntCompOp},
+			.compare_mask = gfxpip.cmpMask,
+			.write_mask = gfxpip.wrtMask,
+			.enable_depth_test = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDTEST),
+			.enable_depth_write = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDWRT),
+			.enable_stencil_test = (bool)(gfxpip.enFlags & CAAF_GFXP_ENSTEST)};
+
+		info.props = gfxpip.props;
+
+		// Subsections
+		caaf::subRange<caaf::vtxBufDesc> vbds = caaf::getSubsection<caaf::GFXP, caaf::vtxBufDesc>(gfxpip);
+		caaf::subRange<caaf::vtxAttr> vas = caaf::getSubsection<caaf::GFXP, caaf::vtxAttr>(gfxpip);
+
+		uint16_t vbdCount = vbds.size(), vaCount = vas.size();
+
+		SDL_GPUVertexBufferDescription vtxBufDescs[vbdCount];
+		SDL_GPUVertexAttribute vtxAttrs[vaCount];
+
+		info.vertex_input_state = {.vertex_buffer_descriptions = vtxBufDescs,
+								   .num_vertex_buffers = vbdCount,
+								   .vertex_attributes = vtxAttrs,
+								   .num_vertex_attributes = vaCount};
+
+		for (uint16_t i = 0; i < vbdCount; i++) {
+			const caaf::vtxBufDesc &vbd = vbds[i];
+			vtxBufDescs[i] = {.slot = i, .pitch = vbd.pitch, .input_rate = (SDL_GPUVertexInputRate)vbd.instStp};
+			// FIXME: Add support for instance_step_rate once SDL supports it.
+		}
+
+		for (uint16_t i = 0; i < vaCount; i++) {
+			const caaf::vtxAttr &va = vas[i];
+			vtxAttrs[i] = {.location = va.loc,
+						   .buffer_slot = va.slot,
+						   .format = (SDL_GPUVertexElementFormat)va.format,
+						   .offset = va.offset};
+		}
+
+		caaf::subRange<caaf::colTargBlend> ctbs = caaf::getSubsection<caaf::GFXP, caaf::colTargBlend>(gfxpip);
+		uint16_t ctbCount = ctbs.size();
+
+		SDL_GPUColorTargetDescription colTargDescs[ctbCount];
+		SDL_GPUTextureFormat depthStencilFormat = gpu->getDepthStencilFormat();
+
+		info.target_info = {.color_target_descriptions = colTargDescs,
+							.num_color_targets = ctbCount,
+							.depth_stencil_format = depthStencilFormat,
+							.has_depth_stencil_target = depthStencilFormat != SDL_GPU_TEXTUREFORMAT_INVALID};
+
+		for (uint16_t i = 0; i < ctbCount; i++) {
+			const caaf::colTargBlend &ctb = ctbs[i];
+			colTargDescs[i] = {
+				.format = gpu->getColorTargetFormat(),
+				.blend_state = {.src_color_blendfactor = (SDL_GPUBlendFactor)ctb.srcCol,
+								.dst_color_blendfactor = (SDL_GPUBlendFactor)ctb.dstCol,
+								.color_blend_op = (SDL_GPUBlendOp)ctb.colBlendOp,
+								.src_alpha_blendfactor = (SDL_GPUBlendFactor)ctb.srcAlpha,
+								.dst_alpha_blendfactor = (SDL_GPUBlendFactor)ctb.dstAlpha,
+								.alpha_blend_op = (SDL_GPUBlendOp)ctb.alphaBlendOp,
+								.color_write_mask = ctb.rgbaMask,
+								.enable_blend = (bool)(ctb.enFlags & CAAF_CTB_ENBLEND),
+								.enable_color_write_mask = (bool)(ctb.enFlags & CAAF_CTB_ENMASK)}};
+		}
+
+		// Indices into the whole chain, resolved once the chain is built
+		caaf::subRange<caaf::textSampBind> tsbs = caaf::getSubsection<caaf::GFXP, caaf::textSampBind>(gfxpip);
+		model::mesh &mesh = modl->meshes[j];
+
+		mesh.bindingCnt = tsbs.size();
+		if (mesh.bindingCnt) mesh.bindings = new model::binding[mesh.bindingCnt];
+
+		for (uint16_t i = 0; i < mesh.bindingCnt; i++) {
+			const caaf::textSampBind &tsb = tsbs[i];
+			mesh.bindings[i] = {.slot = tsb.slot,
+								.stage = (SDL_GPUShaderStage)tsb.shStage,
+								.texModel = nullptr,
+								.texIdx = tsb.textIdx,
+								.sampModel = nullptr,
+								.sampIdx = tsb.sampIdx};
+		}
 
-					memcpy(mmesh->vtxData, meshStart, mesh.vtxSize);
-					memcpy(mmesh->idxData, meshStart + mesh.vtxSize, mesh.idxSize);
+		if (info.vertex_shader == nullptr || info.fragment_shader == nullptr) {
+			cerr << "Warning: missing shaders for pipeline " << j << " of model " << modl->name << endl;
+			continue;
+		}
+
+		// Everything the pipeline is created from, string indexes and subsection pointers differ between equal ones.
+		// Shaders are keyed by name and by the hash of their file, an evicted shader may be loaded again with a
+		// different handle or from a file that changed.
+		caaf::gfxPip state = gfxpip;
+		state.vertNameIdx = state.fragNameIdx = 0;
+		state.vbdPtr = state.vaPtr = state.ctbPtr = state.tsbPtr = 0;
+
+		string key;
+		appendKey(key, state);
+		appendKey(key, vertName);
+		appendKey(key, vertHash);
+		appendKey(key, fragName);
+		appendKey(key, fragHash);
+		appendKey(key, gpu->getColorTargetFormat());
+		appendKey(key, depthStencilFormat);
+		appendKey(key, vbdCount);
+		appendKey(key, vaCount);
+		appendKey(key, ctbCount);
+
+		for (const caaf::vtxBufDesc &vbd : vbds)
+			appendKey(key, vbd);
+
+		for (const caaf::vtxAttr &va : vas)
+			appendKey(key, va);
+
+		for (const caaf::colTargBlend &ctb : ctbs)
+			appendKey(key, ctb);
+
+		modl->pipelines[j] = gpu->getPipelines().acquire(key, info);
+		if (modl->pipelines[j] == nullptr) cerr << SDL_GetError() << endl;
+	}
+
+	loadTextures(*caaf, modl, gpu, load);
+
+	caaf::entryRange<caaf::SAMP> samplers = caaf->entries<caaf::SAMP>();
+	modl->samplerCnt = samplers.size();
+
+	if (modl->samplerCnt) modl->samplers = new SDL_GPUSampler *[modl->samplerCnt]();
+
+	for (uint32_t j = 0; j < samplers.size(); j++) {
+		const caaf::sampler &sampler = samplers[j];
+
+		SDL_GPUSamplerCreateInfo info = {.min_filter = (SDL_GPUFilter)sampler.minFilt,
+										 .mag_filter = (SDL_GPUFilter)sampler.magFilt,
+										 .mipmap_mode = (SDL_GPUSamplerMipmapMode)sampler.mapMode,
+										 .address_mode_u = (SDL_GPUSamplerAddressMode)sampler.addrModeU,
+										 .address_mode_v = (SDL_GPUSamplerAddressMode)sampler.addrModeV,
+										 .address_mode_w = (SDL_GPUSamplerAddressMode)sampler.addrModeW,
+										 .mip_lod_bias = sampler.mipLODBias,
+										 .max_anisotropy = sampler.maxAnis,
+										 .compare_op = (SDL_GPUCompareOp)sampler.compOp,
+										 .min_lod = sampler.minLOD,
+										 .max_lod = sampler.maxLOD,
+										 .enable_anisotropy = (bool)(sampler.enFlags & CAAF_SAMP_ENANIS),
+										 .enable_compare = (bool)(sampler.enFlags & CAAF_SAMP_ENCOMP),
+										 .props = sampler.props};
+
+		// The entry holds every byte of state the sampler is created from
+		string key;
+		appendKey(key, sampler);
+
+		modl->samplers[j] = gpu->getSamplers().acquire(key, info);
+		if (modl->samplers[j] == nullptr) cerr << SDL_GetError() << endl;
+	}
+
+	// Indices into the dependency are resolved from here on
+	joinDependency();
+
+#ifndef CAAF_ENABLE_DEBUG_TOOLS
+	// Debug tools keep the source so that mesh data stays readable without copying it
+	delete modl->source;
+	modl->source = nullptr;
 #endif
 
-					break;
-				}
+	return modl;
+}
 
-				case caaf::GFXP: {
-					caaf::gfxPip gfxpip = *(caaf::gfxPip *)entryPtr;
-					string vertName = caaf::getString(strSec, gfxpip.vertNameIdx, strLimit);
-					string fragName = caaf::getString(strSec, gfxpip.fragNameIdx, strLimit);
-
-					SDL_GPUGraphicsPipelineCreateInfo info = {};
-
-					if (!vertName.empty() && loadShader(vertName, device, pass))
-						info.vertex_shader = loadedShaders[vertName];
-
-					if (!fragName.empty() && loadShader(fragName, device, pass))
-						info.fragment_shader = loadedShaders[fragName];
-
-					info.primitive_type = (SDL_GPUPrimitiveType)gfxpip.primType;
-
-					info.rasterizer_state = {.fill_mode = (SDL_GPUFillMode)gfxpip.fillMod,
-											 .cull_mode = (SDL_GPUCullMode)gfxpip.cullMod,
-											 .front_face = (SDL_GPUFrontFace)gfxpip.frontFace,
-											 .depth_bias_constant_factor = gfxpip.depthBiasConst,
-											 .depth_bias_clamp = gfxpip.depthBiasClamp,
-											 .depth_bias_slope_factor = gfxpip.depthBiasSlope,
-											 .enable_depth_bias = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDBIAS),
-											 .enable_depth_clip = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDCLIP)};
-
-					info.multisample_state = {.sample_count = (SDL_GPUSampleCount)gfxpip.msCnt,
-											  // FIXME: Uncomment once SDL supports it
-											  //.sample_mask = gfxpip.msMask,
-											  //.enable_mask = (bool)(gfxpip.enFlags & CAAF_CTB_ENMASK),
-											  .enable_alpha_to_coverage = (bool)(gfxpip.enFlags & CAAF_GFXP_ENA2COV)};
-
-					info.depth_stencil_state = {
-						.compare_op = (SDL_GPUCompareOp)gfxpip.compOp,
-						.back_stencil_state = {.fail_op = (SDL_GPUStencilOp)gfxpip.bckFailOp,
-											   .pass_op = (SDL_GPUStencilOp)gfxpip.bckPassOp,
-											   .depth_fail_op = (SDL_GPUStencilOp)gfxpip.bckDFailOp,
-											   .compare_op = (SDL_GPUCompareOp)gfxpip.bckCompOp},
-						.front_stencil_state = {.fail_op = (SDL_GPUStencilOp)gfxpip.fntFailOp,
-												.pass_op = (SDL_GPUStencilOp)gfxpip.fntPassOp,
-												.depth_fail_op = (SDL_GPUStencilOp)gfxpip.fntDFailOp,
-												.compare_op = (SDL_GPUCompareOp)gfxpip.fntCompOp},
-						.compare_mask = gfxpip.cmpMask,
-						.write_mask = gfxpip.wrtMask,
-						.enable_depth_test = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDTEST),
-						.enable_depth_write = (bool)(gfxpip.enFlags & CAAF_GFXP_ENDWRT),
-						.enable_stencil_test = (bool)(gfxpip.enFlags & CAAF_GFXP_ENSTEST)};
-
-					info.props = gfxpip.props;
-
-					// Subsections
-					uint8_t *vbdPtr = entryPtr + gfxpip.vbdPtr, *vaPtr = entryPtr + gfxpip.vaPtr,
-							*ctbPtr = entryPtr + gfxpip.ctbPtr, *tsbPtr = entryPtr + gfxpip.tsbPtr;
-
-					uint16_t vbdCount = caaf::getSubEntryCnt(vbdPtr), vaCount = caaf::getSubEntryCnt(vaPtr);
-
-					SDL_GPUVertexBufferDescription vtxBufDescs[vbdCount];
-					SDL_GPUVertexAttribute vtxAttrs[vaCount];
-
-					info.vertex_input_state = {.vertex_buffer_descriptions = vtxBufDescs,
-											   .num_vertex_buffers = vbdCount,
-											   .vertex_attributes = vtxAttrs,
-											   .num_vertex_attributes = vaCount};
-
-					for (uint16_t i = 0; i < vbdCount; i++) {
-						caaf::vtxBufDesc vbd = *(caaf::vtxBufDesc *)caaf::getSubEntryPtr(vbdPtr, i);
-						vtxBufDescs[i] = {
-							.slot = i, .pitch = vbd.pitch, .input_rate = (SDL_GPUVertexInputRate)vbd.instStp};
-						// FIXME: Add support for instance_step_rate once SDL supports it.
-					}
+// internal method
+// Takes ownership of the file. Uploads are recorded in load instead of being made.
+model::model *loadModel(openedFile opened, const char *root, openedFile (*depsFunc)(const char *, const char *),
+						gpu::backend *gpu, pendingLoad &load)
+{
+	shared_ptr<prefetch> pre;
+	model::model *res = loadOpened(opened, root, depsFunc, gpu, load, pre);
 
-					for (uint16_t i = 0; i < vaCount; i++) {
-						caaf::vtxAttr va = *(caaf::vtxAttr *)caaf::getSubEntryPtr(vaPtr, i);
-						vtxAttrs[i] = {.location = va.loc,
-									   .buffer_slot = va.slot,
-									   .format = (SDL_GPUVertexElementFormat)va.format,
-									   .offset = va.offset};
-					}
+	// Left running by a model that failed early or that turned out to depend on something else
+	if (pre != nullptr) joinPrefetch(*pre, load);
+
+	return res;
+}
 
-					// TODO: Read Blending and Texture Sampler Binding subsections
+// internal method
+// Returns the cache entry of a model that is being published, counting what it takes in memory.
+// Payloads only count on the GPU, except in views that are kept after loading.
+cachedModel measureModel(const model::handle &modl)
+{
+	cachedModel res = {.modl = modl, .lastUse = ++useClock, .cpuSize = sizeof(model::model) + modl->name.size()};
 
-					break;
-				}
+	res.cpuSize += (uint64_t)modl->meshCnt * (sizeof(model::mesh) + sizeof(SDL_GPUGraphicsPipeline *));
+	if (modl->source != nullptr) res.cpuSize += sizeof(caaf::view) + modl->source->getSize();
 
-				case caaf::TEXD: {
-					caaf::texture texture = *(caaf::texture *)entryPtr;
-					break;
-				}
+	for (uint32_t i = 0; i < modl->meshCnt; i++) {
+		const model::mesh &mesh = modl->meshes[i];
+
+		res.cpuSize += (uint64_t)mesh.vtxOffsCnt * sizeof(uint32_t);
+		res.cpuSize += (uint64_t)mesh.bindingCnt * sizeof(model::binding);
+		res.gpuSize += (uint64_t)mesh.vtx.size + mesh.idx.size;
+	}
+
+	res.cpuSize += (uint64_t)modl->textureCnt * sizeof(SDL_GPUTexture *);
+	res.cpuSize += (uint64_t)modl->samplerCnt * sizeof(SDL_GPUSampler *);
+	res.cpuSize += (uint64_t)modl->chainLen * sizeof(model::chainLink);
+	res.gpuSize += modl->textureBytes;
+
+	return res;
+}
+
+// internal method
+// Removes a model from the cache, the lock must be held. Returns the cache's handle, to be dropped without the lock.
+model::handle dropModel(unordered_map<intern::atom, cachedModel>::iterator it)
+{
+	cpuUsed -= it->second.cpuSize;
+	gpuUsed -= it->second.gpuSize;
+
+	model::handle res = std::move(it->second.modl);
+	recentlyUsed.erase(it->second.use);
+	loadedModels.erase(it);
+
+	return res;
+}
+
+// internal method
+// Evicts the least recently used models and shaders until both budgets are met, the lock must be held.
+// Models used since keptFrom are kept, and so are models referred to by anything but the cache, such as a handle or
+// a dependent model that is loaded or still loading. Shaders are kept while loads are running, since a load may be
+// creating a pipeline from one. Evicted models are destroyed right away, so a dependency whose last dependent was
+// evicted can go in the same pass.
+void evict(uint64_t keptFrom)
+{
+	auto overBudget = []() { return (cpuBudget && cpuUsed > cpuBudget) || (gpuBudget && gpuUsed > gpuBudget); };
 
-				case caaf::SAMP: {
-					caaf::sampler sampler = *(caaf::sampler *)entryPtr;
-					break;
+	// Walks the recently used list from its back. A dependency left only to the cache is walked again if it was
+	// passed before its last dependent was evicted.
+	for (bool freed = true; freed && overBudget();) {
+		freed = false;
+
+		for (auto it = recentlyUsed.end(); it != recentlyUsed.begin() && overBudget();) {
+			auto use = prev(it);
+
+			if (use->shader) {
+				if (runningLoads) {
+					it = use;
+					continue;
 				}
 
-				default:
-					break;
+				auto shader = loadedShaders.find(use->name);
+				gpuUsed -= shader->second.gpuSize;
+				shader->second.gpu->releaseShader(shader->second.shader);
+				recentlyUsed.erase(use);
+				loadedShaders.erase(shader);
+				continue;
+			}
+
+			auto modl = loadedModels.find(use->name);
+
+			if (modl->second.lastUse >= keptFrom || modl->second.modl.useCount() != 1) {
+				it = use;
+				continue;
 			}
+
+			model::handle dep = dropModel(modl)->dependsOn;
+			freed |= dep && dep.useCount() == 2; // Held by dep and the cache only
 		}
 	}
+}
 
-	return modl;
+// internal method
+// Releases every cached shader, the lock must be held and no load may be running.
+void releaseShaders()
+{
+	// Pipelines keep working without the shaders they were created from
+	for (const auto &[key, entry] : loadedShaders) {
+		gpuUsed -= entry.gpuSize;
+		entry.gpu->releaseShader(entry.shader);
+		recentlyUsed.erase(entry.use);
+	}
+
+	loadedShaders.clear();
+	shadersCleared = false;
 }
 
 // internal method
-SDL_GPUShader *loadShader(uint8_t *csaf, SDL_GPUDevice *device)
+// Runs on a worker, the load is left for finishLoads.
+void runLoad(pendingLoad *load, string path, string root, openedFile (*openFunc)(const char *, const char *),
+			 gpu::backend *gpu)
 {
-	csaf::header header = *(csaf::header *)csaf;
+	openedFile file = openFunc(path.c_str(), root.c_str());
 
-	// Possible errors: magic number does not match or version does not match
-	if (string(header.magic) != CSAF_HEADER_MAGIC || header.version != CSAF_VERSION) return nullptr;
+	if (file.view != nullptr || file.packed != nullptr)
+		load->ok = loadModel(file, root.c_str(), openFunc, gpu, *load) != nullptr;
 
-	SDL_GPUShaderFormat formats = header.shaderFormats;
-	SDL_GPUShaderFormat targetFormat = resolvePlatformShaderFormat(formats, device);
+	lock_guard guard(cacheLock);
+	finishedLoads.push_back(load);
+	loadFinished.notify_all();
+}
 
-	auto [code, size] = csaf::getShaderCode(csaf, formats, targetFormat);
+// internal method
+shared_future<bool> readyResult(bool value)
+{
+	promise<bool> res;
+	res.set_value(value);
+	return res.get_future().share();
+}
 
-	SDL_GPUShaderCreateInfo info = {.code_size = size,
-									.code = code,
-									.entrypoint = targetFormat == SDL_GPU_SHADERFORMAT_MSL ? "main0" : "main",
-									.format = targetFormat,
-									.stage = (SDL_GPUShaderStage)header.stage,
-									.num_samplers = header.sampleCnt,
-									.num_storage_textures = header.storageTexCnt,
-									.num_storage_buffers = header.storageBufCnt,
-									.num_uniform_buffers = header.uniformBufCnt};
+// internal method
+// Finishes loads on the calling thread until the result is ready.
+bool waitLoad(shared_future<bool> result, gpu::backend *gpu)
+{
+	while (result.wait_for(chrono::seconds(0)) != future_status::ready) {
+		{
+			unique_lock guard(cacheLock);
+			auto finished = []() { return !finishedLoads.empty(); };
+
+			// Staged loads are retried unsignalled, once the loads sharing their slots are done filling them
+			if (stagedLoads.empty()) loadFinished.wait(guard, finished);
+			else loadFinished.wait_for(guard, chrono::milliseconds(1), finished);
+		}
+
+		if (!finishLoads(gpu)) return false;
+	}
+
+	return result.get();
+}
+
+shared_future<bool> loadModelAsync(string name, gpu::backend *gpu)
+{
+	intern::atom atom = intern::get(name);
+	shared_future<bool> res;
+
+	{
+		lock_guard guard(cacheLock);
+
+		auto loaded = loadedModels.find(atom);
+
+		if (loaded != loadedModels.end()) {
+			loaded->second.lastUse = ++useClock;
+			markUsed(loaded->second.use);
+			return readyResult(true);
+		}
+
+		auto it = loadingModels.find(atom);
+		if (it != loadingModels.end()) return it->second.result;
+
+		res = addLoading(atom).result;
+		runningLoads++;
+	}
+
+	pendingLoad *load =
+		new pendingLoad{.request = atom, .sections = loadedSections, .stream = streamPayloads, .ok = false};
+
+	jobs::submit([=]() { runLoad(load, name + EXT_CAAF, STORAGE_CAAF_ROOT, &loadCommon, gpu); });
+	return res;
+}
+
+bool loadModel(string name, gpu::backend *gpu)
+{
+	return waitLoad(loadModelAsync(name, gpu), gpu);
+}
+
+bool finishLoads(gpu::backend *gpu)
+{
+	vector<pendingLoad *> finished, staged;
+
+	{
+		lock_guard guard(cacheLock);
+		finished.swap(stagedLoads);
+		finished.insert(finished.end(), finishedLoads.begin(), finishedLoads.end());
+		finishedLoads.clear();
+	}
+
+	if (finished.empty()) return true;
+
+	// Transfer buffers must not be mapped while uploads from them are recorded
+	gpu::stagingRing &ring = gpu->getStaging();
+
+	erase_if(finished, [&](pendingLoad *load) {
+		for (const gpu::stagingRegion &region : load->regions)
+			if (!ring.beginRecording(region)) {
+				staged.push_back(load);
+				return true;
+			}
+
+		return false;
+	});
+
+	if (finished.empty() || !gpu->beginUpload()) {
+		ring.endRecording();
+
+		lock_guard guard(cacheLock);
+		stagedLoads.swap(staged);
+		finishedLoads.insert(finishedLoads.begin(), finished.begin(), finished.end());
+		return finished.empty();
+	}
+
+	for (pendingLoad *load : finished) {
+		for (const upload &up : load->uploads)
+			gpu->uploadToBuffer(up.src, up.dst, false);
+
+		for (const texUpload &up : load->texUploads)
+			gpu->uploadToTexture(up.src, up.dst, false);
+
+		for (SDL_GPUTexture *texture : load->mipmapped)
+			gpu->generateMipmaps(texture);
+
+		for (const gpu::stagingRegion &region : load->regions)
+			ring.retire(region);
+	}
 
-	return SDL_CreateGPUShader(device, &info);
+	ring.endRecording();
+
+	bool uploaded = gpu->endUpload();
+	vector<pair<shared_ptr<promise<bool>>, bool>> results;
+
+	for (pendingLoad *load : finished)
+		load->uploaded = uploaded;
+
+	{
+		lock_guard guard(cacheLock);
+		uint64_t publishedFrom = useClock + 1; // Models that were just published are not evicted right away
+
+		chainingLoads.insert(chainingLoads.end(), finished.begin(), finished.end());
+		finished.clear();
+
+		// Chains left by loads whose dependency another load was opening, built in dependency order. Every load
+		// builds the chains it can, so this ends once the loads opening the dependencies are finished too.
+		for (bool built = true; built;) {
+			built = false;
+
+			for (pendingLoad *load : chainingLoads)
+				for (intern::atom name : load->models) {
+					model::model *modl = findLoading(name);
+
+					if (modl != nullptr && modl->chain == nullptr &&
+						(!modl->dependsOn || modl->dependsOn->chain != nullptr)) {
+						modl->buildChain();
+						built = true;
+					}
+				}
+		}
+
+		// Published once every model they opened has its chain
+		erase_if(chainingLoads, [&finished](pendingLoad *load) {
+			for (intern::atom name : load->models) {
+				model::model *modl = findLoading(name);
+				if (modl != nullptr && modl->chain == nullptr) return false;
+			}
+
+			finished.push_back(load);
+			return true;
+		});
+
+		for (pendingLoad *load : finished) {
+			for (intern::atom name : load->models) {
+				auto it = loadingModels.find(name);
+				if (it == loadingModels.end() || !it->second.modl) continue;
+
+				cachedModel entry = measureModel(it->second.modl);
+				entry.use = recentlyUsed.insert(recentlyUsed.begin(), {.name = name, .shader = false});
+
+				loadedModels[name] = entry;
+				cpuUsed += entry.cpuSize;
+				gpuUsed += entry.gpuSize;
+
+				results.push_back({it->second.done, load->uploaded});
+				loadingModels.erase(it);
+			}
+
+			// The requested file was missing, malformed or named differently in its header
+			auto it = loadingModels.find(load->request);
+
+			if (load->request != 0 && it != loadingModels.end() && !it->second.modl) {
+				results.push_back({it->second.done, load->ok && load->uploaded});
+				loadingModels.erase(it);
+			}
+
+			if (load->done != nullptr) results.push_back({load->done, load->ok && load->uploaded});
+		}
+
+		stagedLoads.swap(staged);
+		runningLoads -= finished.size();
+		if (!runningLoads && shadersCleared) releaseShaders();
+
+		evict(publishedFrom);
+	}
+
+	for (auto &[done, value] : results)
+		done->set_value(value);
+
+	for (pendingLoad *load : finished)
+		delete load;
+
+	return uploaded;
 }
 
-bool loadModel(string name, SDL_GPUDevice *device, SDL_GPUCopyPass *pass)
+bool loadShader(string name, gpu::backend *gpu)
 {
-	if (loadedModels.contains(name)) return true;
+	return getShader(intern::get(name), gpu) != nullptr;
+}
 
-	string path = name + EXT_CAAF;
-	uint8_t *caaf = loadCommon(path.c_str(), STORAGE_CAAF_ROOT);
+void setStreaming(bool enabled)
+{
+	streamPayloads = enabled;
+}
 
-	if (caaf == nullptr) return false;
+void setLoadedSections(uint32_t sections)
+{
+	loadedSections = sections | caaf::sectionBit(caaf::STRT);
+}
 
-	model::model *modl = loadModel(caaf, STORAGE_CAAF_ROOT, &loadCommon, device, pass);
-	delete[] caaf;
+void setCacheBudgets(uint64_t cpuBytes, uint64_t gpuBytes)
+{
+	lock_guard guard(cacheLock);
 
-	return modl != nullptr;
+	cpuBudget = cpuBytes;
+	gpuBudget = gpuBytes;
+	evict(UINT64_MAX);
 }
 
-bool loadShader(string name, SDL_GPUDevice *device, SDL_GPUCopyPass *pass)
+void getCacheUsage(uint64_t *cpuBytes, uint64_t *gpuBytes)
 {
-	if (loadedShaders.contains(name)) return true;
+	lock_guard guard(cacheLock);
 
-	string path = name + EXT_CSAF;
-	uint8_t *csaf = loadCommon(path.c_str(), STORAGE_CSAF_ROOT);
+	*cpuBytes = cpuUsed;
+	*gpuBytes = gpuUsed;
+}
 
-	if (csaf == nullptr) return false;
+model::handle getModel(string name)
+{
+	lock_guard guard(cacheLock);
+	auto it = loadedModels.find(intern::get(name));
+
+	if (it == loadedModels.end()) return {};
 
-	SDL_GPUShader *res = loadShader(csaf, device);
-	delete[] csaf;
+	it->second.lastUse = ++useClock;
+	markUsed(it->second.use);
+	return it->second.modl;
+}
 
-	if (res == nullptr) return false;
+bool unloadModel(string name)
+{
+	model::handle modl;
+
+	{
+		lock_guard guard(cacheLock);
+		auto it = loadedModels.find(intern::get(name));
+
+		if (it == loadedModels.end()) return false;
+		modl = dropModel(it);
+	}
+
+	// Dependencies that were only kept for this model go along with it
+	while (modl) {
+		model::handle dep = modl->dependsOn;
+		modl.reset();
+
+		if (!dep || !dep->isDependency) break;
+
+		lock_guard guard(cacheLock);
+		auto it = loadedModels.find(intern::get(dep->name));
+
+		// Referred to by something else than the cache and dep
+		if (it == loadedModels.end() || it->second.modl != dep || dep.useCount() > 2) break;
+
+		modl = dropModel(it);
+	}
 
-	loadedShaders[name] = res;
 	return true;
 }
 
 void clearModels()
 {
-	for (const auto [key, value] : loadedModels)
-		delete value;
+	vector<model::handle> cleared; // Dropped once the lock is released
+	lock_guard guard(cacheLock);
 
-	loadedModels.clear();
+	while (!loadedModels.empty())
+		cleared.push_back(dropModel(loadedModels.begin()));
 }
 
 void clearShaders()
 {
-	// for (const auto [key, value] : loadedModels)
-	// 	delete SDL_ReleaseGPUShader(device, value);
+	lock_guard guard(cacheLock);
 
-	loadedShaders.clear();
+	// A running load may be creating a pipeline from a cached shader
+	if (runningLoads) shadersCleared = true;
+	else releaseShaders();
 }
 
-SDL_GPUShaderFormat resolvePlatformShaderFormat(SDL_GPUShaderFormat formats, SDL_GPUDevice *device)
+SDL_GPUShaderFormat resolvePlatformShaderFormat(SDL_GPUShaderFormat formats, gpu::backend *gpu)
 {
-	SDL_GPUShaderFormat supportedFormats = SDL_GetGPUShaderFormats(device);
+	SDL_GPUShaderFormat supportedFormats = gpu->getShaderFormats();
 
 	if (supportedFormats & SDL_GPU_SHADERFORMAT_MSL && formats & SDL_GPU_SHADERFORMAT_MSL)
 		return SDL_GPU_SHADERFORMAT_MSL;
@@ -444,25 +1675,29 @@ SDL_GPUShaderFormat resolvePlatformShaderFormat(SDL_GPUShaderFormat formats, SDL
 
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
 
-bool readModel(string path, SDL_GPUDevice *device, SDL_GPUCopyPass *pass)
+shared_future<bool> readModelAsync(string path, gpu::backend *gpu)
 {
-	filesystem::path root, file;
+	filesystem::path p = filesystem::path(path);
+
+	pendingLoad *load = new pendingLoad{.request = 0,
+										.sections = loadedSections,
+										.stream = streamPayloads,
+										.done = make_shared<promise<bool>>(),
+										.ok = false};
+	shared_future<bool> res = load->done->get_future().share();
 
 	{
-		filesystem::path p = filesystem::path(path);
-		root = p.parent_path();
-		file = p.filename();
+		lock_guard guard(cacheLock);
+		runningLoads++;
 	}
 
-	uint8_t *caaf = readCommon(file.c_str(), root.c_str());
-
-	if (caaf == nullptr) return false;
-
-	// Load model:
-	model::model *modl = loadModel(caaf, root.c_str(), &readCommon, device, pass);
-	delete[] caaf;
+	jobs::submit([=]() { runLoad(load, p.filename().string(), p.parent_path().string(), &readCommon, gpu); });
+	return res;
+}
 
-	return modl != nullptr;
+bool readModel(string path, gpu::backend *gpu)
+{
+	return waitLoad(readModelAsync(path, gpu), gpu);
 }
 
 #endif
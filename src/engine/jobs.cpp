@@ -0,0 +1,205 @@
+#include "engine/jobs.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace engine
+{
+namespace jobs
+{
+
+// Workers and their queue, stopped when the program exits
+class workerPool
+{
+  public:
+	vector<thread> threads;
+	deque<function<void()>> queue;
+	mutex lock;
+	condition_variable available;
+	bool stopping = false;
+	uint32_t threadCnt = 0;
+
+	~workerPool()
+	{
+		shutdown();
+	}
+};
+
+static workerPool pool;
+
+// Shared by the calls of a parallelFor, helpers may outlive the call that started them
+typedef struct batch {
+	const function<void(size_t)> *func;
+	size_t count;
+	atomic<size_t> next;
+	atomic<size_t> finished;
+	mutex lock;
+	condition_variable done;
+} batch;
+
+// Shared by a task and the job queued for it
+struct task::state {
+	function<void()> job;
+	atomic<bool> claimed;
+	mutex lock;
+	condition_variable finished;
+	bool done;
+};
+
+// internal method
+void work()
+{
+	unique_lock guard(pool.lock);
+
+	while (true) {
+		pool.available.wait(guard, []() { return pool.stopping || !pool.queue.empty(); });
+
+		if (pool.queue.empty()) return; // Stopping with nothing left to run
+
+		function<void()> job = move(pool.queue.front());
+		pool.queue.pop_front();
+
+		guard.unlock();
+		job();
+		guard.lock();
+	}
+}
+
+// internal method
+// Runs calls of the batch until none are left. Returns once the last call it ran has finished.
+void runBatch(batch &bat)
+{
+	for (size_t i = bat.next++; i < bat.count; i = bat.next++) {
+		(*bat.func)(i);
+
+		if (++bat.finished == bat.count) {
+			lock_guard guard(bat.lock);
+			bat.done.notify_all();
+		}
+	}
+}
+
+// internal method
+// Returns the number of workers the pool runs with, the lock must be held.
+uint32_t getThreads()
+{
+	return pool.threadCnt ? pool.threadCnt : max(thread::hardware_concurrency(), 1u);
+}
+
+void setThreads(uint32_t threads)
+{
+	lock_guard guard(pool.lock);
+	pool.threadCnt = threads;
+}
+
+void submit(function<void()> job)
+{
+	lock_guard guard(pool.lock);
+
+	// While stopping, the workers that are being stopped run the job before they exit
+	if (pool.threads.empty() && !pool.stopping) {
+		uint32_t count = getThreads();
+
+		for (uint32_t i = 0; i < count; i++)
+			pool.threads.emplace_back(work);
+	}
+
+	pool.queue.push_back(move(job));
+	pool.available.notify_one();
+}
+
+void parallelFor(size_t count, const function<void(size_t)> &func)
+{
+	if (count == 0) return;
+
+	if (count == 1) {
+		func(0);
+		return;
+	}
+
+	shared_ptr<batch> bat = make_shared<batch>();
+	bat->func = &func;
+	bat->count = count;
+	bat->next = 0;
+	bat->finished = 0;
+
+	size_t helpers;
+
+	{
+		lock_guard guard(pool.lock);
+		helpers = min<size_t>(count - 1, getThreads());
+	}
+
+	// Helpers that start late find nothing left to do
+
+	for (size_t i = 0; i < helpers; i++)
+		submit([bat]() { runBatch(*bat); });
+
+	runBatch(*bat);
+
+	unique_lock guard(bat->lock);
+	bat->done.wait(guard, [&]() { return bat->finished == count; });
+}
+
+// internal method
+// Runs the job unless another thread claimed it first.
+void task::run(state &st)
+{
+	if (st.claimed.exchange(true)) return;
+
+	st.job();
+
+	lock_guard guard(st.lock);
+	st.done = true;
+	st.finished.notify_all();
+}
+
+task::task(function<void()> job) : shared(make_shared<state>())
+{
+	shared->job = move(job);
+	shared->claimed = false;
+	shared->done = false;
+
+	submit([st = shared]() { run(*st); });
+}
+
+void task::join()
+{
+	if (shared == nullptr) return;
+
+	// Claimed by a worker, which is already running it
+	run(*shared);
+
+	unique_lock guard(shared->lock);
+	shared->finished.wait(guard, [&]() { return shared->done; });
+}
+
+void shutdown()
+{
+	vector<thread> stopped;
+
+	{
+		lock_guard guard(pool.lock);
+		pool.stopping = true;
+		pool.available.notify_all();
+		stopped = move(pool.threads);
+	}
+
+	for (thread &worker : stopped)
+		worker.join();
+
+	lock_guard guard(pool.lock);
+	pool.threads.clear();
+	pool.stopping = false;
+}
+
+} // namespace jobs
+} // namespace engine
@@ -0,0 +1,191 @@
+#include "engine/lz4.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // The last bytes of a block are always literals
+#define LZ4_MF_LIMIT 12 // A match must start at least this many bytes before the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+#define LZ4_RUN_MASK 15
+#define LZ4_WILD_COPY 16 // Bytes copied at once when there is room to overrun
+
+namespace engine
+{
+namespace lz4
+{
+
+// internal method
+// Reads a length continued in extra bytes, each 255 means another byte follows.
+bool readLength(const uint8_t *&ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (ip >= iend) return false;
+
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+
+	return true;
+}
+
+bool decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize)
+{
+	const uint8_t *ip = src, *iend = src + srcSize;
+	uint8_t *op = dst, *oend = dst + dstSize;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		// Literals
+		size_t litLen = token >> 4;
+		if (litLen == LZ4_RUN_MASK && !readLength(ip, iend, &litLen)) return false;
+
+		if (litLen > (size_t)(iend - ip) || litLen > (size_t)(oend - op)) return false;
+
+		// Short runs copy a fixed 16 bytes when both buffers have room, later writes overwrite the excess
+		if (litLen <= LZ4_WILD_COPY && iend - ip >= 2 * LZ4_WILD_COPY && oend - op >= 2 * LZ4_WILD_COPY)
+			memcpy(op, ip, LZ4_WILD_COPY);
+		else
+			memcpy(op, ip, litLen);
+
+		ip += litLen;
+		op += litLen;
+
+		if (ip == iend) break; // The last sequence has no match
+
+		// Match
+		if (iend - ip < 2) return false;
+
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - dst)) return false;
+
+		size_t matchLen = token & LZ4_RUN_MASK;
+		if (matchLen == LZ4_RUN_MASK && !readLength(ip, iend, &matchLen)) return false;
+
+		matchLen += LZ4_MIN_MATCH;
+		if (matchLen > (size_t)(oend - op)) return false;
+
+		const uint8_t *match = op - offset;
+
+		if (offset >= 8 && (size_t)(oend - op) >= matchLen + 8) {
+			// Each 8 byte chunk only reads bytes that were already written, even when the match overlaps
+			for (size_t i = 0; i < matchLen; i += 8)
+				memcpy(op + i, match + i, 8);
+		} else if (offset >= matchLen)
+			memcpy(op, match, matchLen);
+		else {
+			// Overlapping match, repeats the last offset bytes
+			for (size_t i = 0; i < matchLen; i++)
+				op[i] = match[i];
+		}
+
+		op += matchLen;
+	}
+
+	return op == oend;
+}
+
+#ifdef CAAF_ENABLE_DEBUG_TOOLS
+
+// internal method
+uint32_t read32(const uint8_t *p)
+{
+	uint32_t res;
+	memcpy(&res, p, sizeof(res));
+	return res;
+}
+
+// internal method
+// Hashes the next 5 bytes, which collides less than 4 on structured data such as vertices.
+uint32_t hash(const uint8_t *p)
+{
+	uint64_t seq;
+	memcpy(&seq, p, sizeof(seq));
+
+	return (uint32_t)(((seq << 24) * 889523592379ull) >> (64 - LZ4_HASH_BITS));
+}
+
+// internal method
+void writeLength(vector<uint8_t> &out, size_t len)
+{
+	for (len -= LZ4_RUN_MASK; len >= 255; len -= 255)
+		out.push_back(255);
+
+	out.push_back((uint8_t)len);
+}
+
+// internal method
+// Writes a sequence of literals followed by a match, the last sequence has matchLen 0 and no match.
+void writeSequence(vector<uint8_t> &out, const uint8_t *literals, size_t litLen, size_t offset, size_t matchLen)
+{
+	size_t matchCode = matchLen ? matchLen - LZ4_MIN_MATCH : 0;
+
+	uint8_t token = (uint8_t)(min<size_t>(litLen, LZ4_RUN_MASK) << 4 | min<size_t>(matchCode, LZ4_RUN_MASK));
+	out.push_back(token);
+
+	if (litLen >= LZ4_RUN_MASK) writeLength(out, litLen);
+	out.insert(out.end(), literals, literals + litLen);
+
+	if (!matchLen) return;
+
+	out.push_back((uint8_t)offset);
+	out.push_back((uint8_t)(offset >> 8));
+
+	if (matchCode >= LZ4_RUN_MASK) writeLength(out, matchCode);
+}
+
+void compress(const uint8_t *data, size_t size, vector<uint8_t> &out)
+{
+	vector<uint32_t> table(1 << LZ4_HASH_BITS, 0);
+	size_t anchor = 0, pos = 0, attempts = 1 << 6;
+
+	if (size > LZ4_MF_LIMIT) {
+		size_t matchLimit = size - LZ4_LAST_LITERALS, posLimit = size - LZ4_MF_LIMIT;
+
+		while (pos < posLimit) {
+			uint32_t seq = read32(data + pos);
+			uint32_t &slot = table[hash(data + pos)];
+			size_t cand = slot;
+			slot = (uint32_t)pos;
+
+			// Any earlier position with the same bytes is a valid match, stale slots simply fail the compare
+			if (cand >= pos || pos - cand > LZ4_MAX_OFFSET || read32(data + cand) != seq) {
+				pos += attempts++ >> 6; // Skip faster through incompressible data
+				continue;
+			}
+
+			while (pos > anchor && cand > 0 && data[pos - 1] == data[cand - 1]) {
+				pos--;
+				cand--;
+			}
+
+			size_t len = LZ4_MIN_MATCH;
+			while (pos + len < matchLimit && data[pos + len] == data[cand + len])
+				len++;
+
+			writeSequence(out, data + anchor, pos - anchor, pos - cand, len);
+
+			pos += len;
+			anchor = pos;
+			attempts = 1 << 6;
+
+			// Positions inside the match were skipped, keep one near its end so runs of matches are found
+			if (pos - 2 < posLimit) table[hash(data + pos - 2)] = (uint32_t)(pos - 2);
+		}
+	}
+
+	writeSequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+#endif
+
+} // namespace lz4
+} // namespace engine
@@ -1,80 +1,164 @@
 #include "engine/lzma.h"
 #include "engine/caaf.h"
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
-#include <fstream>
 #include <lzma.h>
-#include <string>
+#include <new>
+#include <vector>
 
 namespace engine
 {
 namespace lzma
 {
 
-uint8_t *decompress(const uint8_t *data, size_t *size)
+static atomic<uint32_t> threadCnt = 0;
+
+// internal method
+uint32_t getThreads()
 {
-	lzma_stream strm = LZMA_STREAM_INIT;
-	size_t srcsize = *size;
+	uint32_t threads = threadCnt;
 
-	// Get uncompressed file size:
+	if (threads == 0) threads = lzma_cputhreads();
+	return threads ? threads : 1;
+}
 
-	lzma_index *idx;
-	lzma_ret ret = lzma_file_info_decoder(&strm, &idx, CAAF_DECOMP_MEMORY_MAX, srcsize);
+void setThreads(uint32_t threads)
+{
+	threadCnt = threads;
+}
 
-	if (ret != LZMA_OK) {
-		lzma_end(&strm);
-		return nullptr;
-	}
+// internal method
+// Reads the uncompressed size from the index of each stream, walking back from the end of the file.
+// Only the stream footers and indexes are touched, never the compressed blocks.
+bool getUncompressedSize(const uint8_t *data, size_t size, uint64_t *res)
+{
+	*res = 0;
 
-	strm.next_in = data;
-	strm.avail_in = srcsize;
-	ret = lzma_code(&strm, LZMA_RUN);
+	while (size > 0) {
+		// Stream padding, a multiple of 4 null bytes
+		while (size >= 4 && !data[size - 1] && !data[size - 2] && !data[size - 3] && !data[size - 4])
+			size -= 4;
 
-	if (ret != LZMA_STREAM_END) {
-		lzma_end(&strm);
-		return nullptr;
-	}
+		if (size < 2 * LZMA_STREAM_HEADER_SIZE) return false;
 
-	size_t ressize = lzma_index_uncompressed_size(idx); // Uncompressed file size
-	idx = nullptr;
+		lzma_stream_flags footer;
+		if (lzma_stream_footer_decode(&footer, data + size - LZMA_STREAM_HEADER_SIZE) != LZMA_OK) return false;
 
-	// Decompress file (lzma frees everything from before):
+		if (footer.backward_size > size - 2 * LZMA_STREAM_HEADER_SIZE) return false;
 
-	uint8_t *outbuf = new uint8_t[ressize];
-	ret = lzma_stream_decoder(&strm, CAAF_DECOMP_MEMORY_MAX, 0);
+		const uint8_t *idxStart = data + size - LZMA_STREAM_HEADER_SIZE - footer.backward_size;
 
-	if (ret != LZMA_OK) {
-		lzma_end(&strm);
-		delete[] outbuf;
-		return nullptr;
+		lzma_index *idx;
+		uint64_t memlimit = CAAF_DECOMP_MEMORY_MAX;
+		size_t idxPos = 0;
+
+		if (lzma_index_buffer_decode(&idx, &memlimit, nullptr, idxStart, &idxPos, footer.backward_size) != LZMA_OK)
+			return false;
+
+		*res += lzma_index_uncompressed_size(idx);
+		lzma_vli streamSize = lzma_index_stream_size(idx);
+		lzma_index_end(idx, nullptr);
+
+		if (streamSize > size) return false;
+		size -= streamSize;
 	}
 
+	return true;
+}
+
+decoder::decoder(const uint8_t *data, size_t size) : strm(LZMA_STREAM_INIT), outSize(0), valid(false)
+{
+	// Get uncompressed file size from the index:
+	if (!getUncompressedSize(data, size, &outSize)) return;
+
+	// Falls back to a single thread when the stream has one block or the memory limit would be exceeded
+	lzma_mt mt = {.flags = LZMA_CONCATENATED,
+				  .threads = getThreads(),
+				  .timeout = 0,
+				  .memlimit_threading = CAAF_DECOMP_MEMORY_MAX,
+				  .memlimit_stop = CAAF_DECOMP_MEMORY_MAX};
+
+	if (lzma_stream_decoder_mt(&strm, &mt) != LZMA_OK) return;
+
 	strm.next_in = data;
-	strm.avail_in = srcsize;
-	strm.next_out = outbuf;
-	strm.avail_out = ressize;
-	ret = lzma_code(&strm, LZMA_RUN);
+	strm.avail_in = size;
+	valid = true;
+}
 
+decoder::~decoder()
+{
 	lzma_end(&strm);
+}
+
+bool decoder::read(uint8_t *out, size_t len)
+{
+	if (!valid || len > outSize - strm.total_out) return valid = false;
+
+	strm.next_out = out;
+	strm.avail_out = len;
+
+	// The threaded decoder may return before every block is done
+	while (strm.avail_out) {
+		lzma_ret ret = lzma_code(&strm, LZMA_RUN);
+
+		if (ret != LZMA_OK && (ret != LZMA_STREAM_END || strm.avail_out)) return valid = false;
+	}
+
+	return true;
+}
+
+bool decoder::finish()
+{
+	if (!valid || strm.total_out != outSize) return false;
+
+	uint8_t extra;
+	strm.next_out = &extra;
+	strm.avail_out = 1;
 
-	if (ret != LZMA_STREAM_END) {
+	// Nothing but the stream index and footer should be left
+	lzma_ret ret;
+
+	do {
+		ret = lzma_code(&strm, LZMA_FINISH);
+	} while (ret == LZMA_OK && strm.avail_out);
+
+	return ret == LZMA_STREAM_END && strm.avail_out;
+}
+
+uint8_t *decompress(const uint8_t *data, size_t *size)
+{
+	decoder dec(data, *size);
+
+	if (!dec.isValid() || dec.getSize() > SIZE_MAX) return nullptr;
+
+	// Decompress file in a single pass:
+
+	uint8_t *outbuf = new (nothrow) uint8_t[dec.getSize()];
+
+	if (outbuf == nullptr || !dec.read(outbuf, dec.getSize()) || !dec.finish()) {
 		delete[] outbuf;
 		return nullptr;
 	}
 
-	*size = ressize;
+	*size = dec.getSize();
 	return outbuf;
 }
 
 #ifdef CAAF_ENABLE_DEBUG_TOOLS
-bool compress(const uint8_t *data, size_t size, string fileout)
+bool compress(const uint8_t *data, size_t size, vector<uint8_t> &out, uint64_t blockSize)
 {
-	ofstream fstrm(fileout);
 	uint8_t outbuf[BUFSIZ];
 
 	lzma_stream strm = LZMA_STREAM_INIT;
-	lzma_ret ret = lzma_easy_encoder(&strm, CAAF_LZMA_LEVEL, LZMA_CHECK_CRC64);
+	lzma_mt mt = {.threads = getThreads(),
+				  .block_size = blockSize,
+				  .timeout = 0,
+				  .preset = CAAF_LZMA_LEVEL,
+				  .check = LZMA_CHECK_CRC64};
+
+	lzma_ret ret = lzma_stream_encoder_mt(&strm, &mt);
 
 	if (ret != LZMA_OK) {
 		lzma_end(&strm);
@@ -83,14 +167,15 @@ bool compress(const uint8_t *data, size_t size, string fileout)
 
 	strm.next_in = data;
 	strm.avail_in = size;
-	strm.next_out = outbuf;
-	strm.avail_out = BUFSIZ;
 
 	do {
+		strm.next_out = outbuf;
+		strm.avail_out = BUFSIZ;
+
 		ret = lzma_code(&strm, LZMA_FINISH);
-		if (ret != LZMA_OK || ret != LZMA_STREAM_END) break;
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) break;
 
-		fstrm.write((char *)outbuf, strm.avail_out);
+		out.insert(out.end(), outbuf, outbuf + BUFSIZ - strm.avail_out);
 	} while (ret == LZMA_OK);
 
 	lzma_end(&strm);
@@ -1,31 +1,144 @@
 #include "engine/model.h"
 #include <SDL3/SDL_gpu.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <utility>
 
 namespace engine
 {
 namespace model
 {
 
-mesh::~mesh()
+SDL_GPUTextureSamplerBinding binding::get() const
 {
-	SDL_ReleaseGPUBuffer(device, vtxBuf);
-	SDL_ReleaseGPUBuffer(device, idxBuf);
+	return {.texture = texIdx < texModel->textureCnt ? texModel->textures[texIdx] : nullptr,
+			.sampler = sampIdx < sampModel->samplerCnt ? sampModel->samplers[sampIdx] : nullptr};
+}
 
+mesh::~mesh()
+{
 	delete[] vtxOffsets;
+	delete[] bindings;
+}
+
+handle::handle(model *modl) : modl(modl)
+{
+	if (modl != nullptr) modl->refCnt.fetch_add(1, memory_order_relaxed);
+}
+
+handle::handle(const handle &other) : handle(other.modl) {}
 
-#ifdef CAAF_ENABLE_DEBUG_TOOLS
-	delete[] vtxData;
-	delete[] idxData;
-#endif
+handle::handle(handle &&other) noexcept : modl(other.modl)
+{
+	other.modl = nullptr;
+}
+
+handle::~handle()
+{
+	reset();
+}
+
+handle &handle::operator=(handle other) noexcept
+{
+	swap(modl, other.modl);
+	return *this;
+}
+
+uint32_t handle::useCount() const
+{
+	return modl != nullptr ? modl->refCnt.load(memory_order_acquire) : 0;
+}
+
+void handle::reset()
+{
+	// The last handle deletes the model, after every other handle is done with it
+	if (modl != nullptr && modl->refCnt.fetch_sub(1, memory_order_acq_rel) == 1) delete modl;
+	modl = nullptr;
+}
+
+model::model(gpu::backend *gpu)
+	: gpu(gpu), refCnt(0), isDependency(false), entryCnts(), chainLen(0), chain(nullptr), meshCnt(0), meshes(nullptr),
+	  pipelines(nullptr), textureCnt(0), textures(nullptr), textureBytes(0), samplerCnt(0), samplers(nullptr),
+	  blendStateCnt(0), blendStates(nullptr), source(nullptr)
+{
 }
 
 model::~model()
 {
-	for (uint32_t i = 0; i < meshCnt; i++)
-		SDL_ReleaseGPUGraphicsPipeline(device, pipelines[i]);
+	// Ranges and pipelines are given back here since meshes do not know the backend
+	for (uint32_t i = 0; i < meshCnt; i++) {
+		gpu->getVertexHeap().free(meshes[i].vtx);
+		gpu->getIndexHeap().free(meshes[i].idx);
+		gpu->getPipelines().release(pipelines[i]);
+	}
+
+	for (uint32_t i = 0; i < textureCnt; i++)
+		gpu->releaseTexture(textures[i]);
+
+	for (uint32_t i = 0; i < samplerCnt; i++)
+		gpu->getSamplers().release(samplers[i]);
 
 	delete[] meshes;
 	delete[] pipelines;
+	delete[] textures;
+	delete[] samplers;
+	delete[] chain;
+	delete source;
+}
+
+void model::buildChain()
+{
+	const model *dep = dependsOn.get();
+
+	chainLen = dep != nullptr ? dep->chainLen + 1 : 1;
+	chain = new chainLink[chainLen];
+	chain[0] = {.modl = this, .bases = {}};
+
+	// The chain of the dependency is shifted past the entries of this model
+	for (uint32_t i = 1; i < chainLen; i++) {
+		chain[i].modl = dep->chain[i - 1].modl;
+
+		for (uint8_t j = 0; j < caaf::sectionCnt; j++)
+			chain[i].bases[j] = dep->chain[i - 1].bases[j] + entryCnts[j];
+	}
+
+	for (uint32_t i = 0; i < meshCnt; i++) {
+		mesh &msh = meshes[i];
+		uint32_t kept = 0;
+
+		for (uint32_t j = 0; j < msh.bindingCnt; j++) {
+			binding bind = msh.bindings[j];
+
+			bind.texModel = resolve(caaf::TEXD, bind.texIdx);
+			bind.sampModel = resolve(caaf::SAMP, bind.sampIdx);
+
+			if (bind.texModel == nullptr || bind.sampModel == nullptr) {
+				cerr << "Warning: binding " << j << " of mesh " << i << " of model " << name << " is out of range."
+					 << endl;
+				continue;
+			}
+
+			msh.bindings[kept++] = bind;
+		}
+
+		msh.bindingCnt = kept;
+	}
+}
+
+const model *model::resolve(caaf::section type, uint32_t &idx) const
+{
+	// Last model starting at or before idx, models without entries share their base with the next one
+	auto startsAfter = [type](uint32_t value, const chainLink &entry) { return value < entry.bases[type]; };
+	const chainLink *link = upper_bound(chain, chain + chainLen, idx, startsAfter);
+
+	if (link == chain) return nullptr;
+	link--;
+
+	if (idx - link->bases[type] >= link->modl->entryCnts[type]) return nullptr;
+
+	idx -= link->bases[type];
+	return link->modl;
 }
 
 } // namespace model
@@ -0,0 +1,195 @@
+#include "engine/staging.h"
+#include "engine/gpu.h"
+#include <SDL3/SDL_gpu.h>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+namespace engine
+{
+namespace gpu
+{
+
+stagingRing::stagingRing(backend *gpu, uint32_t slotSize, uint16_t slotCnt)
+	: gpu(gpu), slotSize(slotSize & ~(uint32_t)(STAGING_ALIGN - 1)), slots(slotCnt ? slotCnt : 1), current(0),
+	  submitted(0), completed(0)
+{
+}
+
+// internal method
+// Releases the fences of finished uploads, waiting for the ones up to waitFor. Must be called with the lock held.
+void stagingRing::poll(uint64_t waitFor)
+{
+	while (!fences.empty()) {
+		auto [serial, fence] = fences.front();
+
+		if (fence != nullptr) {
+			bool done = serial <= waitFor ? gpu->waitForFence(fence) : gpu->queryFence(fence);
+			if (!done) return;
+
+			gpu->releaseFence(fence);
+		}
+
+		completed = serial;
+		fences.pop_front();
+	}
+}
+
+// internal method
+// Moves to the next slot once the current one is full, returns nullptr if its regions are still being filled.
+// Must be called with the lock held.
+stagingRing::slot *stagingRing::nextSlot()
+{
+	uint16_t next = slots[current].transBuf == nullptr ? current : (current + 1) % slots.size();
+	slot &s = slots[next];
+
+	if (s.pending || s.recording) return nullptr;
+
+	if (s.transBuf == nullptr) {
+		s.transBuf = gpu->createTransferBuffer(slotSize);
+		if (s.transBuf == nullptr) return nullptr;
+	} else if (s.serial > submitted) {
+		// The upload reading the slot is still being recorded, the GPU memory is swapped instead of overwritten
+		gpu->mapTransferBuffer(s.transBuf, true);
+		gpu->unmapTransferBuffer(s.transBuf);
+	} else {
+		poll(s.serial);
+	}
+
+	s.head = 0;
+	current = next;
+
+	return &s;
+}
+
+uint8_t *stagingRing::acquire(uint64_t size, stagingRegion &region)
+{
+	region = {.transBuf = nullptr, .offset = 0, .size = (uint32_t)size, .slot = STAGING_NO_SLOT};
+
+	if (!size || size > UINT32_MAX) return nullptr;
+
+	if (size <= slotSize) {
+		lock_guard guard(lock);
+		slot *s = &slots[current];
+
+		// The rest of a slot being recorded from is skipped
+		if (s->transBuf == nullptr || s->recording || size > slotSize - s->head) s = nextSlot();
+
+		if (s != nullptr && s->mapped == nullptr) s->mapped = (uint8_t *)gpu->mapTransferBuffer(s->transBuf, false);
+
+		if (s != nullptr && s->mapped != nullptr) {
+			region.transBuf = s->transBuf;
+			region.offset = s->head;
+			region.slot = s - slots.data();
+
+			s->head = min<uint64_t>(slotSize, (s->head + size + STAGING_ALIGN - 1) & ~(uint64_t)(STAGING_ALIGN - 1));
+			s->pending++;
+			s->mapCnt++;
+
+			return s->mapped + region.offset;
+		}
+	}
+
+	region.transBuf = gpu->createTransferBuffer(size);
+	if (region.transBuf == nullptr) return nullptr;
+
+	uint8_t *mapped = (uint8_t *)gpu->mapTransferBuffer(region.transBuf, false);
+
+	if (mapped == nullptr) {
+		gpu->releaseTransferBuffer(region.transBuf);
+		region.transBuf = nullptr;
+	}
+
+	return mapped;
+}
+
+void stagingRing::unmap(const stagingRegion &region)
+{
+	if (region.slot == STAGING_NO_SLOT) {
+		gpu->unmapTransferBuffer(region.transBuf);
+		return;
+	}
+
+	lock_guard guard(lock);
+	slot &s = slots[region.slot];
+
+	if (--s.mapCnt) return;
+
+	gpu->unmapTransferBuffer(s.transBuf);
+	s.mapped = nullptr;
+}
+
+bool stagingRing::beginRecording(const stagingRegion &region)
+{
+	if (region.slot == STAGING_NO_SLOT) return true;
+
+	lock_guard guard(lock);
+	slot &s = slots[region.slot];
+
+	// Another load is filling the slot, it is left to that load so that the mapping ends
+	if (s.mapCnt) {
+		s.head = slotSize;
+		return false;
+	}
+
+	s.recording = true;
+	return true;
+}
+
+void stagingRing::endRecording()
+{
+	lock_guard guard(lock);
+
+	for (slot &s : slots)
+		s.recording = false;
+}
+
+void stagingRing::retire(const stagingRegion &region)
+{
+	if (region.slot == STAGING_NO_SLOT) {
+		// Kept alive by the device until the upload has finished
+		gpu->releaseTransferBuffer(region.transBuf);
+		return;
+	}
+
+	lock_guard guard(lock);
+	slot &s = slots[region.slot];
+
+	s.pending--;
+	s.serial = submitted + 1;
+}
+
+void stagingRing::discard(const stagingRegion &region)
+{
+	if (region.slot == STAGING_NO_SLOT) {
+		gpu->releaseTransferBuffer(region.transBuf);
+		return;
+	}
+
+	lock_guard guard(lock);
+	slots[region.slot].pending--;
+}
+
+void stagingRing::submit(SDL_GPUFence *fence)
+{
+	lock_guard guard(lock);
+
+	fences.push_back({++submitted, fence});
+	poll(0);
+}
+
+void stagingRing::release()
+{
+	lock_guard guard(lock);
+	poll(UINT64_MAX);
+
+	for (slot &s : slots) {
+		gpu->releaseTransferBuffer(s.transBuf);
+		s = {};
+	}
+
+	current = 0;
+}
+
+} // namespace gpu
+} // namespace engine
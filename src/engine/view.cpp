@@ -0,0 +1,110 @@
+#include "engine/view.h"
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace engine
+{
+namespace caaf
+{
+
+view::view(uint8_t *data, size_t size) : data(data), size(size), kind(heap), validated(false), dir() {}
+
+view::~view()
+{
+	if (kind == heap) {
+		delete[] data;
+		return;
+	}
+
+#ifdef _WIN32
+	if (kind == file)
+		UnmapViewOfFile(data);
+	else
+		VirtualFree((void *)data, 0, MEM_RELEASE);
+#else
+	munmap((void *)data, size);
+#endif
+}
+
+view *view::map(const char *path)
+{
+	void *addr = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file =
+		CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	CloseHandle(file);
+	if (mapping == nullptr) return nullptr;
+
+	addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); // The view keeps the mapping alive
+
+	if (addr == nullptr) return nullptr;
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return nullptr;
+	}
+
+	size = (size_t)st.st_size;
+	addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping stays valid after closing
+
+	if (addr == MAP_FAILED) return nullptr;
+#endif
+
+	view *res = new view(nullptr, 0);
+	res->data = (const uint8_t *)addr;
+	res->size = size;
+	res->kind = file;
+
+	return res;
+}
+
+view *view::reserve(size_t size, uint8_t **buffer)
+{
+	if (!size) return nullptr;
+
+#ifdef _WIN32
+	void *addr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (addr == nullptr) return nullptr;
+#else
+	void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) return nullptr;
+#endif
+
+	view *res = new view(nullptr, 0);
+	res->data = (const uint8_t *)addr;
+	res->size = size;
+	res->kind = anonymous;
+
+	*buffer = (uint8_t *)addr;
+	return res;
+}
+
+} // namespace caaf
+} // namespace engine
@@ -0,0 +1,516 @@
+#include "engine/caaf.h"
+#include "engine/codec.h"
+#include "engine/lzma.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// SDL_GPU enum values written into the generated files
+#define GEN_COMPAREOP_LESS 2
+#define GEN_STENCILOP_KEEP 1
+#define GEN_VERTEXFORMAT_FLOAT2 10
+#define GEN_VERTEXFORMAT_FLOAT3 11
+#define GEN_BLENDFACTOR_ONE 2
+#define GEN_BLENDFACTOR_ONE_MINUS_SRC_ALPHA 8
+#define GEN_BLENDFACTOR_SRC_ALPHA 7
+#define GEN_BLENDOP_ADD 1
+#define GEN_TEXTUREFORMAT_R8G8B8A8_UNORM 4
+#define GEN_TEXTURETYPE_2D 0
+#define GEN_FILTER_LINEAR 1
+#define GEN_SHADERSTAGE_VERTEX 0
+#define GEN_SHADERSTAGE_FRAGMENT 1
+#define GEN_SHADERFORMAT_SPIRV (1u << 1)
+#define GEN_SHADERFORMAT_DXIL (1u << 3)
+#define GEN_SHADERFORMAT_MSL (1u << 4)
+
+#define GEN_VERTEX_PITCH 20 // float3 position + float2 uv
+#define GEN_VERT_SHADER "gen_vert"
+#define GEN_FRAG_SHADER "gen_frag"
+
+using namespace std;
+using namespace engine;
+
+typedef struct options {
+	uint32_t actors = 1;
+	uint32_t meshes = 8;
+	uint32_t pipelines = 0; // Distinct pipeline states, 0 means one per mesh
+	uint32_t vertices = 1024;
+	uint32_t indices = 3072;
+	uint32_t strings = 0;
+	uint32_t stringLen = 16;
+	uint32_t textures = 0;
+	uint32_t texSize = 256;
+	uint16_t mipLvls = 1;
+	uint32_t samplers = 0;
+	uint32_t deps = 0;
+	uint32_t depTextures = 4;
+	uint32_t shaderSize = 4096;
+	uint32_t seed = 1;
+	uint32_t blockSize = CAAF_LZMA_BLOCK_SIZE;
+	uint32_t threads = 0;
+	codec::id codec = codec::xz;
+	bool chunked = false;
+	bool raw = false;
+} options;
+
+// Little-endian byte buffer with helpers for relative pointers.
+class writer
+{
+  public:
+	vector<uint8_t> buf;
+
+	size_t pos() const
+	{
+		return buf.size();
+	}
+
+	void align(size_t to)
+	{
+		buf.resize((buf.size() + to - 1) & ~(to - 1), 0);
+	}
+
+	size_t putBytes(const void *data, size_t size)
+	{
+		size_t res = buf.size();
+		buf.insert(buf.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+		return res;
+	}
+
+	template <typename T> size_t put(const T &value)
+	{
+		return putBytes(&value, sizeof(T));
+	}
+
+	size_t reserve(size_t size)
+	{
+		size_t res = buf.size();
+		buf.resize(res + size, 0);
+		return res;
+	}
+
+	template <typename T> T *at(size_t offset)
+	{
+		return (T *)(buf.data() + offset);
+	}
+
+	// Writes at offset a pointer to target, relative to base.
+	void patchRel(size_t offset, size_t base, size_t target)
+	{
+		*at<uint32_t>(offset) = (uint32_t)(target - base);
+	}
+
+	// Starts a section and returns the offset of its pointer array.
+	size_t beginSection(const char (&magic)[5], uint32_t count, size_t listPos)
+	{
+		align(4);
+		*at<uint32_t>(listPos) = (uint32_t)pos();
+
+		caaf::secHeader header;
+		memcpy(header.magic, magic, 4);
+		header.count = count;
+		put(header);
+
+		return reserve(count << 2);
+	}
+
+	// Writes a subsection with count copies of entry and returns its offset.
+	template <typename T> size_t putSubsection(const T *entries, uint16_t count)
+	{
+		align(4);
+		size_t res = put(caaf::subHeader{.count = count, .size = sizeof(T)});
+
+		for (uint16_t i = 0; i < count; i++)
+			put(entries[i]);
+
+		return res;
+	}
+};
+
+// xorshift32
+uint32_t nextRand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+caaf::gfxPip makePipeline(uint32_t state)
+{
+	caaf::gfxPip res = {};
+
+	res.vertNameIdx = 0; // Set by caller
+	res.cullMod = state % 3;
+	res.compOp = GEN_COMPAREOP_LESS;
+	res.bckFailOp = res.bckPassOp = res.bckDFailOp = GEN_STENCILOP_KEEP;
+	res.fntFailOp = res.fntPassOp = res.fntDFailOp = GEN_STENCILOP_KEEP;
+	res.bckCompOp = res.fntCompOp = GEN_COMPAREOP_LESS;
+	res.cmpMask = res.wrtMask = 0xFF;
+	res.enFlags = CAAF_GFXP_ENDTEST | CAAF_GFXP_ENDWRT | CAAF_GFXP_ENDCLIP;
+	res.depthBiasConst = (float)(state / 3); // Makes every state distinct
+
+	return res;
+}
+
+vector<uint8_t> buildCaaf(const options &opt, const string &name, const string &depName, uint32_t depTexCnt, bool isDep,
+						  uint32_t seed)
+{
+	uint32_t rand = seed * 2654435761u + 1;
+	uint32_t meshCnt = isDep ? 0 : opt.meshes;
+	uint32_t texCnt = isDep ? opt.depTextures : opt.textures;
+	uint32_t sampCnt = opt.samplers;
+	uint32_t totalTexCnt = texCnt + depTexCnt; // Including the dependency chain
+	uint32_t pipStates = opt.pipelines ? opt.pipelines : meshCnt;
+
+	// String table: "", name, dependency, shaders, filler
+	vector<string> strings = {"", name, depName, GEN_VERT_SHADER, GEN_FRAG_SHADER};
+
+	for (uint32_t i = 0; i < opt.strings; i++) {
+		string str = "str_" + to_string(i) + "_";
+		str.resize(max<size_t>(opt.stringLen, str.size()), 'a' + i % 26);
+		strings.push_back(str);
+	}
+
+	uint16_t sectCnt = 1 + (meshCnt ? 2 : 0) + (texCnt ? 1 : 0) + (sampCnt ? 1 : 0);
+
+	writer w;
+	caaf::header header = {.version = CAAF_VERSION,
+						   .isDep = isDep,
+						   .sectCnt = sectCnt,
+						   .nameIdx = 1,
+						   .depIdx = (uint16_t)(depName.empty() ? 0 : 2)};
+	memcpy(header.magic, CAAF_HEADER_MAGIC, 4);
+
+	w.put(header);
+	w.reserve(CAAF_SECTION_LIST_POS - w.pos());
+
+	size_t listPos = w.reserve(sectCnt << 2);
+	uint16_t sectIdx = 0;
+
+	// STRT
+	size_t ptrs = w.beginSection("STRT", strings.size(), listPos + (sectIdx++ << 2));
+
+	for (size_t i = 0; i < strings.size(); i++) {
+		w.patchRel(ptrs + (i << 2), ptrs + (i << 2), w.pos());
+		w.putBytes(strings[i].c_str(), strings[i].size() + 1);
+	}
+
+	// MESH, payloads are written last so that they form one contiguous block at the end of the file
+	vector<size_t> meshEntries;
+
+	if (meshCnt) {
+		ptrs = w.beginSection("MESH", meshCnt, listPos + (sectIdx++ << 2));
+
+		for (uint32_t i = 0; i < meshCnt; i++) {
+			w.align(4);
+			size_t entry = w.put(caaf::mesh{.vtxSize = opt.vertices * GEN_VERTEX_PITCH, .idxSize = opt.indices * 2});
+			w.patchRel(ptrs + (i << 2), ptrs + (i << 2), entry);
+
+			caaf::vtxBufData vbd = {.start = 0};
+			w.patchRel(entry + offsetof(caaf::mesh, vbdPtr), entry, w.putSubsection(&vbd, 1));
+
+			meshEntries.push_back(entry);
+		}
+
+		// GFXP
+		ptrs = w.beginSection("GFXP", meshCnt, listPos + (sectIdx++ << 2));
+
+		caaf::vtxBufDesc vbd = {.pitch = GEN_VERTEX_PITCH, .instStp = 0};
+		caaf::vtxAttr vas[2] = {{.loc = 0, .format = GEN_VERTEXFORMAT_FLOAT3, .slot = 0, .offset = 0},
+								{.loc = 1, .format = GEN_VERTEXFORMAT_FLOAT2, .slot = 0, .offset = 12}};
+
+		for (uint32_t i = 0; i < meshCnt; i++) {
+			uint32_t state = i % pipStates;
+
+			caaf::gfxPip pip = makePipeline(state);
+			pip.vertNameIdx = 3;
+			pip.fragNameIdx = 4;
+
+			w.align(4);
+			size_t entry = w.put(pip);
+			w.patchRel(ptrs + (i << 2), ptrs + (i << 2), entry);
+
+			caaf::colTargBlend ctb = {.srcCol = GEN_BLENDFACTOR_SRC_ALPHA,
+									  .dstCol = GEN_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+									  .colBlendOp = GEN_BLENDOP_ADD,
+									  .srcAlpha = GEN_BLENDFACTOR_ONE,
+									  .dstAlpha = GEN_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+									  .alphaBlendOp = GEN_BLENDOP_ADD,
+									  .rgbaMask = 0xF,
+									  .enFlags = (uint8_t)(state & 1 ? CAAF_CTB_ENBLEND : 0)};
+
+			caaf::textSampBind tsb = {.slot = 0,
+									  .textIdx = (uint16_t)(totalTexCnt ? i % totalTexCnt : 0),
+									  .sampIdx = (uint16_t)(sampCnt ? i % sampCnt : 0),
+									  .shStage = GEN_SHADERSTAGE_FRAGMENT};
+
+			w.patchRel(entry + offsetof(caaf::gfxPip, vbdPtr), entry, w.putSubsection(&vbd, 1));
+			w.patchRel(entry + offsetof(caaf::gfxPip, vaPtr), entry, w.putSubsection(vas, 2));
+			w.patchRel(entry + offsetof(caaf::gfxPip, ctbPtr), entry, w.putSubsection(&ctb, 1));
+			w.patchRel(entry + offsetof(caaf::gfxPip, tsbPtr), entry,
+					   w.putSubsection(&tsb, totalTexCnt && sampCnt ? 1 : 0));
+		}
+	}
+
+	// TEXD
+	if (texCnt) {
+		ptrs = w.beginSection("TEXD", texCnt, listPos + (sectIdx++ << 2));
+
+		for (uint32_t i = 0; i < texCnt; i++) {
+			caaf::texture tex = {.type = GEN_TEXTURETYPE_2D,
+								 .format = GEN_TEXTUREFORMAT_R8G8B8A8_UNORM,
+								 .mipLvls = opt.mipLvls,
+								 .width = opt.texSize,
+								 .height = opt.texSize,
+								 .depth = 1};
+
+			w.align(4);
+			size_t entry = w.put(tex);
+			w.patchRel(ptrs + (i << 2), ptrs + (i << 2), entry);
+
+			w.align(4);
+			w.patchRel(entry + offsetof(caaf::texture, dataPtr), entry, w.pos());
+
+			size_t dataPos = w.reserve((size_t)opt.texSize * opt.texSize * 4);
+
+			for (uint32_t y = 0; y < opt.texSize; y++)
+				for (uint32_t x = 0; x < opt.texSize; x++) {
+					uint8_t *px = w.at<uint8_t>(dataPos + ((size_t)y * opt.texSize + x) * 4);
+					px[0] = x ^ y;
+					px[1] = x + i;
+					px[2] = y + i;
+					px[3] = 0xFF;
+				}
+		}
+	}
+
+	// SAMP
+	if (sampCnt) {
+		ptrs = w.beginSection("SAMP", sampCnt, listPos + (sectIdx++ << 2));
+
+		for (uint32_t i = 0; i < sampCnt; i++) {
+			caaf::sampler samp = {.minFilt = GEN_FILTER_LINEAR,
+								  .magFilt = GEN_FILTER_LINEAR,
+								  .mapMode = 1,
+								  .addrModeU = (uint8_t)(i % 3),
+								  .addrModeV = (uint8_t)(i % 3),
+								  .addrModeW = (uint8_t)(i % 3),
+								  .maxAnis = 1.0f,
+								  .maxLOD = 1000.0f};
+
+			w.align(4);
+			w.patchRel(ptrs + (i << 2), ptrs + (i << 2), w.put(samp));
+		}
+	}
+
+	// Mesh payloads
+	for (size_t entry : meshEntries) {
+		w.align(4);
+		w.patchRel(entry + offsetof(caaf::mesh, meshPtr), entry, w.pos());
+
+		for (uint32_t v = 0; v < opt.vertices; v++) {
+			float vtx[5] = {(float)(v % 64), (float)(v / 64), (float)(nextRand(&rand) % 16) * 0.0625f,
+							(float)(v % 64) / 64, (float)(v / 64) / 64};
+			w.put(vtx);
+		}
+
+		for (uint32_t idx = 0; idx < opt.indices; idx++)
+			w.put((uint16_t)((idx / 3 + idx % 3) % (opt.vertices ? opt.vertices : 1)));
+	}
+
+	return w.buf;
+}
+
+vector<uint8_t> buildCsaf(const options &opt, uint8_t stage)
+{
+	uint16_t formats = GEN_SHADERFORMAT_SPIRV | GEN_SHADERFORMAT_DXIL | GEN_SHADERFORMAT_MSL;
+	uint8_t shaderCnt = 3;
+
+	writer w;
+	csaf::header header = {.version = CSAF_VERSION,
+						   .stage = stage,
+						   .sampleCnt = (uint8_t)(stage == GEN_SHADERSTAGE_FRAGMENT),
+						   .uniformBufCnt = (uint8_t)(stage == GEN_SHADERSTAGE_VERTEX),
+						   .shaderFormats = formats};
+	memcpy(header.magic, CSAF_HEADER_MAGIC, 4);
+
+	w.put(header);
+	w.reserve(CSAF_SHADER_LIST_POS - w.pos());
+
+	size_t list = w.reserve(shaderCnt * sizeof(csaf::shaderEntry));
+
+	// Shaders are sorted by format bit, filled with placeholder code
+	for (uint8_t i = 0; i < shaderCnt; i++) {
+		w.align(4);
+		*w.at<csaf::shaderEntry>(list + i * sizeof(csaf::shaderEntry)) = {.size = opt.shaderSize,
+																		   .offset = (uint32_t)w.pos()};
+
+		for (uint32_t j = 0; j < opt.shaderSize; j++)
+			w.put((uint8_t)(j * 31 + i));
+	}
+
+	return w.buf;
+}
+
+bool writeFile(const vector<uint8_t> &data, const filesystem::path &path, const options &opt, bool isCaaf)
+{
+	if (opt.raw) {
+		ofstream fstrm(path, ios::binary);
+		fstrm.write((const char *)data.data(), data.size());
+
+		if (!fstrm.good()) return false;
+	}
+
+	filesystem::path packPath = path;
+	packPath += ".pak";
+
+	vector<caaf::range> ranges;
+	if (opt.chunked && isCaaf)
+		ranges = caaf::splitSections(data.data(), data.size(), CAAF_CHUNK_MIN_SIZE, opt.blockSize);
+
+	return codec::compress(data.data(), data.size(), opt.codec, packPath.string(), opt.blockSize, ranges);
+}
+
+void printUsage(const char *name)
+{
+	cerr << "Usage: " << name << " [options] outdir" << endl;
+	cerr << "Writes synthetic models to outdir/models and shaders to outdir/shaders." << endl;
+	cerr << "  --actors N        number of actor files (1)" << endl;
+	cerr << "  --meshes N        meshes per actor (8)" << endl;
+	cerr << "  --pipelines N     distinct pipeline states, 0 for one per mesh (0)" << endl;
+	cerr << "  --vertices N      vertices per mesh, " << GEN_VERTEX_PITCH << " bytes each (1024)" << endl;
+	cerr << "  --indices N       16-bit indices per mesh (3072)" << endl;
+	cerr << "  --strings N       extra strings in the string table (0)" << endl;
+	cerr << "  --string-len N    length of extra strings (16)" << endl;
+	cerr << "  --textures N      RGBA8 textures per actor (0)" << endl;
+	cerr << "  --tex-size N      texture width and height (256)" << endl;
+	cerr << "  --mips N          mip levels per texture (1)" << endl;
+	cerr << "  --samplers N      samplers per file (0)" << endl;
+	cerr << "  --deps N          length of the dependency chain shared by all actors (0)" << endl;
+	cerr << "  --dep-textures N  textures per dependency (4)" << endl;
+	cerr << "  --shader-size N   bytes of code per shader format (4096)" << endl;
+	cerr << "  --seed N          random seed (1)" << endl;
+	cerr << "  --block-size N    bytes per independently compressed xz block (" << CAAF_LZMA_BLOCK_SIZE << ")" << endl;
+	cerr << "  --threads N       compression threads, 0 for one per core (0)" << endl;
+	cerr << "  --codec NAME      none, xz or lz4 (xz)" << endl;
+	cerr << "  --chunked         compress each section of a model on its own, in chunks of up to block size" << endl;
+	cerr << "  --raw             also write uncompressed files" << endl;
+	cerr << "Shader code is placeholder data, it is only meant to be parsed." << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	options opt;
+	const char *outDir = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+
+		if (arg == "--raw") {
+			opt.raw = true;
+			continue;
+		}
+
+		if (arg == "--chunked") {
+			opt.chunked = true;
+			continue;
+		}
+
+		if (arg == "--codec" && i + 1 < argc) {
+			if (!codec::fromName(argv[++i], &opt.codec)) {
+				printUsage(argv[0]);
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (arg.starts_with("--") && i + 1 < argc) {
+			uint32_t value = (uint32_t)strtoul(argv[++i], nullptr, 0);
+
+			if (arg == "--actors") opt.actors = value;
+			else if (arg == "--meshes") opt.meshes = value;
+			else if (arg == "--pipelines") opt.pipelines = value;
+			else if (arg == "--vertices") opt.vertices = value;
+			else if (arg == "--indices") opt.indices = value;
+			else if (arg == "--strings") opt.strings = value;
+			else if (arg == "--string-len") opt.stringLen = value;
+			else if (arg == "--textures") opt.textures = value;
+			else if (arg == "--tex-size") opt.texSize = value;
+			else if (arg == "--mips") opt.mipLvls = (uint16_t)value;
+			else if (arg == "--samplers") opt.samplers = value;
+			else if (arg == "--deps") opt.deps = value;
+			else if (arg == "--dep-textures") opt.depTextures = value;
+			else if (arg == "--shader-size") opt.shaderSize = value;
+			else if (arg == "--seed") opt.seed = value;
+			else if (arg == "--block-size") opt.blockSize = value;
+			else if (arg == "--threads") opt.threads = value;
+			else {
+				printUsage(argv[0]);
+				return 1;
+			}
+
+			continue;
+		}
+
+		if (arg.starts_with("-") || outDir != nullptr) {
+			printUsage(argv[0]);
+			return 1;
+		}
+
+		outDir = argv[i];
+	}
+
+	if (outDir == nullptr || opt.meshes > UINT16_MAX || opt.vertices > UINT16_MAX + 1) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	lzma::setThreads(opt.threads);
+
+	filesystem::path models = filesystem::path(outDir) / "models", shaders = filesystem::path(outDir) / "shaders";
+	filesystem::create_directories(models);
+	filesystem::create_directories(shaders);
+
+	// Dependency chain: dep_0 -> dep_1 -> ... -> dep_(N-1)
+	for (uint32_t i = 0; i < opt.deps; i++) {
+		string name = "dep_" + to_string(i);
+		string depName = i + 1 < opt.deps ? "dep_" + to_string(i + 1) : "";
+
+		uint32_t depTexCnt = (opt.deps - i - 1) * opt.depTextures;
+
+		if (!writeFile(buildCaaf(opt, name, depName, depTexCnt, true, opt.seed + i), models / (name + ".caaf"), opt,
+					   true)) {
+			cerr << "Could not write " << name << endl;
+			return 1;
+		}
+	}
+
+	for (uint32_t i = 0; i < opt.actors; i++) {
+		string name = "actor_" + to_string(i);
+		string depName = opt.deps ? "dep_0" : "";
+
+		uint32_t depTexCnt = opt.deps * opt.depTextures;
+
+		if (!writeFile(buildCaaf(opt, name, depName, depTexCnt, false, opt.seed + opt.deps + i),
+					   models / (name + ".caaf"), opt, true)) {
+			cerr << "Could not write " << name << endl;
+			return 1;
+		}
+	}
+
+	if (!writeFile(buildCsaf(opt, GEN_SHADERSTAGE_VERTEX), shaders / GEN_VERT_SHADER ".csaf", opt, false) ||
+		!writeFile(buildCsaf(opt, GEN_SHADERSTAGE_FRAGMENT), shaders / GEN_FRAG_SHADER ".csaf", opt, false)) {
+		cerr << "Could not write shaders" << endl;
+		return 1;
+	}
+
+	return 0;
+}
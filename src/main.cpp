@@ -1,6 +1,7 @@
 #define SDL_MAIN_USE_CALLBACKS
 
 #include "engine/io.h"
+#include "engine/jobs.h"
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_dialog.h>
 #include <SDL3/SDL_main.h>
@@ -14,6 +15,7 @@ using namespace std;
 
 static SDL_Window *window = nullptr;
 static SDL_GPUDevice *device = nullptr;
+static engine::gpu::sdlBackend *gpu = nullptr;
 
 static Uint64 lastFrame, currentFrame;
 static double frequency, delta;
@@ -54,6 +56,8 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[])
 
 	SDL_SetGPUSwapchainParameters(device, window, SDL_GPU_SWAPCHAINCOMPOSITION_SDR, SDL_GPU_PRESENTMODE_VSYNC);
 
+	gpu = new engine::gpu::sdlBackend(device, SDL_GetGPUSwapchainTextureFormat(device, window));
+
 	lastFrame = 0;
 	currentFrame = SDL_GetPerformanceCounter();
 	frequency = (double)SDL_GetPerformanceFrequency();
@@ -126,15 +130,10 @@ void fileOpened(void *userdata, const char *const *filelist, int filter)
 	size_t idx = 0;
 	const char *current = filelist[idx++];
 
+	// Models load on the workers while frames keep rendering, uploads are finished in SDL_AppIterate
 	while (current != nullptr) {
-		SDL_GPUCommandBuffer *cmdbuf = SDL_AcquireGPUCommandBuffer(device);
-		SDL_GPUCopyPass *pass = SDL_BeginGPUCopyPass(cmdbuf);
-
-		engine::io::readModel(current, device, pass);
+		engine::io::readModelAsync(current, gpu);
 		current = filelist[idx++];
-
-		SDL_EndGPUCopyPass(pass);
-		SDL_SubmitGPUCommandBuffer(cmdbuf);
 	}
 }
 
@@ -148,6 +147,8 @@ SDL_AppResult SDL_AppIterate(void *appstate)
 	currentFrame = SDL_GetPerformanceCounter();
 	delta = (currentFrame - lastFrame) / frequency;
 
+	engine::io::finishLoads(gpu);
+
 	if (ImGui::BeginMainMenuBar()) {
 		if (ImGui::BeginMenu("File")) {
 			if (ImGui::BeginMenu("New")) {
@@ -208,7 +209,12 @@ SDL_AppResult SDL_AppIterate(void *appstate)
 
 void SDL_AppQuit(void *appstate, SDL_AppResult result)
 {
+	engine::jobs::shutdown();
+	engine::io::finishLoads(gpu); // Loads that were still running
 	SDL_WaitForGPUIdle(device);
+	engine::io::clearModels();
+	engine::io::clearShaders();
+	delete gpu;
 	ImGui_ImplSDL3_Shutdown();
 	ImGui_ImplSDLGPU3_Shutdown();
 	ImGui::DestroyContext();